@@ -68,6 +68,8 @@ int _write(int file, char *ptr, int len) {
 	return len;
 }
 W25QXX_HandleTypeDef W25Q128_Details = { 0 };
+W25QXX_LittleFSTypeDef W25Q128_LittleFS = { 0 };
+uint8_t W25Q128_LittleFS_RAM[1024]; // littlefs caches and lookahead
 bool initLittle_FS(void);
 /* USER CODE END 0 */
 
@@ -109,46 +111,48 @@ int main(void) {
 	} else {
 		printf("File system mounted \r\n");
 	}
-	readAndPrintStorageDetails();
-	listFiles();
+	lfs_t *lfs = &W25Q128_LittleFS.lfs;
+	readAndPrintStorageDetails(lfs);
+	listFiles(lfs);
 
 	/********* EXAMPLE TEST OF FILE SYSTEM *********/
 	const char *data = "Hello, LittleFS!";
 	size_t bytes_written;
-	if (saveFileIntoFlash("test.txt", data, strlen(data), &bytes_written)) {
+	if (saveFileIntoFlash(lfs, "test.txt", data, strlen(data),
+			&bytes_written)) {
 		printf("Data written successfully\n");
 	}
 
 	size_t file_size;
-	if (getFileSize("test.txt", &file_size)) {
+	if (getFileSize(lfs, "test.txt", &file_size)) {
 		printf("File size: %u bytes\n", file_size);
 	}
 
 	char buffer[128] = { 0 };
 	size_t bytes_read = 0;
-	if (readFilefromFlash("test.txt", file_size, buffer, &bytes_read)) {
+	if (readFilefromFlash(lfs, "test.txt", file_size, buffer, &bytes_read)) {
 		printf("File content: %s\n", buffer);
 	}
 
 	const char *append_data = "I should be appended in same line ";
-	if (appendDataAtTheEndOfFile("test.txt", append_data, strlen(append_data),
-			&bytes_written)) {
+	if (appendDataAtTheEndOfFile(lfs, "test.txt", append_data,
+			strlen(append_data), &bytes_written)) {
 		printf("Data appended successfully\n");
 	}
 
 	const char *append_data_new = "I should be appended in new line ";
-	if (appendDataAtTheEndOfFileWithNewLine("test.txt", append_data_new,
-			strlen(append_data), &bytes_written)) {
+	if (appendDataAtTheEndOfFileWithNewLine(lfs, "test.txt",
+			append_data_new, strlen(append_data), &bytes_written)) {
 		printf("Data appended successfully\n");
 	}
 
-	if (getFileSize("test.txt", &file_size)) {
+	if (getFileSize(lfs, "test.txt", &file_size)) {
 		printf("File size: %u bytes\n", file_size);
 	}
 
 	memset(buffer, 0, 128);
 	bytes_read = 0;
-	if (readFilefromFlash("test.txt", sizeof(buffer), buffer, &bytes_read)) {
+	if (readFilefromFlash(lfs, "test.txt", sizeof(buffer), buffer, &bytes_read)) {
 		printf("File content: %s\n", buffer);
 	}
 	/* USER CODE END 2 */
@@ -307,19 +311,17 @@ static void MX_GPIO_Init(void) {
 
 /* USER CODE BEGIN 4 */
 bool initLittle_FS(void) {
-	W25Q128_Details.spiHandle = &hspi1;
-	W25Q128_Details.cs_port = SPI1_CS_GPIO_Port;
-	W25Q128_Details.cs_pin = SPI1_CS_Pin;
-	W25Q128_Details.manufacturer_id = 0XEF;
-	W25Q128_Details.device_id = 0X4018;
-	W25Q128_Details.block_size = 4096;
-	W25Q128_Details.block_count = 4096;
-	W25Q128_Details.sector_size = 4096;
-	W25Q128_Details.sectors_in_block = 1;
-	W25Q128_Details.page_size = 256;
-	W25Q128_Details.pages_in_sector = 16;
-
-	w25qxx_littlefs_init(&W25Q128_Details);
+	if (w25qxx_init(&W25Q128_Details, &hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin)
+			!= W25QXX_Ok) {
+		printf("[ ERROR ] W25Qxx flash not detected \r\n");
+		return false;
+	}
+
+	W25Q128_LittleFS.ram = W25Q128_LittleFS_RAM;
+	W25Q128_LittleFS.ram_size = sizeof(W25Q128_LittleFS_RAM);
+	if (w25qxx_littlefs_init(&W25Q128_LittleFS, &W25Q128_Details, 0, 0) != 0) {
+		return false;
+	}
 	return true;
 }
 /* USER CODE END 4 */
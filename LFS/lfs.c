@@ -26,6 +26,110 @@ enum {
 };
 
 
+/// Metadata pair cache ///
+
+// find a previously fetched pair and move it to the front
+static const lfs_mdir_t *lfs_mcache_find(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+#if LFS_MDIR_CACHE > 0
+    for (lfs_size_t i = 0; i < lfs->mcache_count; i++) {
+        const lfs_mdir_t *m = &lfs->mcache[i];
+        if ((m->pair[0] == pair[0] && m->pair[1] == pair[1])
+                || (m->pair[0] == pair[1] && m->pair[1] == pair[0])) {
+            lfs_mdir_t hit = *m;
+            memmove(&lfs->mcache[1], &lfs->mcache[0], i*sizeof(lfs_mdir_t));
+            lfs->mcache[0] = hit;
+            return &lfs->mcache[0];
+        }
+    }
+#else
+    (void)lfs;
+    (void)pair;
+#endif
+    return NULL;
+}
+
+static void lfs_mcache_insert(lfs_t *lfs, const lfs_mdir_t *dir) {
+#if LFS_MDIR_CACHE > 0
+    if (lfs->mcache_count < LFS_MDIR_CACHE) {
+        lfs->mcache_count += 1;
+    }
+    memmove(&lfs->mcache[1], &lfs->mcache[0],
+            (lfs->mcache_count-1)*sizeof(lfs_mdir_t));
+    lfs->mcache[0] = *dir;
+#else
+    (void)lfs;
+    (void)dir;
+#endif
+}
+
+// drop any pair containing a block that is about to change on disk
+#ifndef LFS_READONLY
+static void lfs_mcache_drop(lfs_t *lfs, lfs_block_t block) {
+#if LFS_MDIR_CACHE > 0
+    lfs_size_t j = 0;
+    for (lfs_size_t i = 0; i < lfs->mcache_count; i++) {
+        if (lfs->mcache[i].pair[0] != block
+                && lfs->mcache[i].pair[1] != block) {
+            lfs->mcache[j++] = lfs->mcache[i];
+        }
+    }
+    lfs->mcache_count = j;
+#else
+    (void)lfs;
+    (void)block;
+#endif
+}
+#endif
+
+#if LFS_NAME_INDEX
+// the name index is a packed list of records, one per indexed pair, each
+// a pair header followed by an entry per id in the pair
+struct lfs_nindex_entry {
+    uint32_t tag;   // name tag, 0 if the id has no name to match
+    lfs_off_t off;  // of the name in the pair's current block
+    uint32_t hash;  // crc32 of the name
+};
+
+struct lfs_nindex_pair {
+    lfs_mdir_t m;       // state the index was built from
+    lfs_size_t count;
+    uint8_t last[8];    // start of the last name, to skip the pair in RAM
+};
+
+static inline lfs_size_t lfs_nindex_size(lfs_size_t count) {
+    return sizeof(struct lfs_nindex_pair)
+            + count*sizeof(struct lfs_nindex_entry);
+}
+#endif
+
+// drop the name index of any pair containing a block about to change
+#ifndef LFS_READONLY
+static void lfs_nindex_drop(lfs_t *lfs, lfs_block_t block) {
+#if LFS_NAME_INDEX
+    struct lfs_nindex *nindex = &lfs->nindex;
+    lfs_size_t used = 0;
+    lfs_size_t off = 0;
+    while (off < nindex->used) {
+        const struct lfs_nindex_pair *p
+                = (const void*)&nindex->buffer[off];
+        lfs_size_t size = lfs_nindex_size(p->count);
+        if (p->m.pair[0] != block && p->m.pair[1] != block) {
+            // keep records packed from the start of the buffer
+            memmove(&nindex->buffer[used], &nindex->buffer[off], size);
+            used += size;
+        }
+        off += size;
+    }
+    nindex->used = used;
+#else
+    (void)lfs;
+    (void)block;
+#endif
+}
+#endif
+
+
 /// Caching block device operations ///
 
 static inline void lfs_cache_drop(lfs_t *lfs, lfs_cache_t *rcache) {
@@ -177,6 +281,8 @@ static int lfs_bd_flush(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate) {
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->block_count);
+        lfs_mcache_drop(lfs, pcache->block);
+        lfs_nindex_drop(lfs, pcache->block);
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
         int err = lfs->cfg->prog(lfs->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
@@ -274,6 +380,8 @@ static int lfs_bd_prog(lfs_t *lfs,
 #ifndef LFS_READONLY
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->block_count);
+    lfs_mcache_drop(lfs, block);
+    lfs_nindex_drop(lfs, block);
     int err = lfs->cfg->erase(lfs->cfg, block);
     LFS_ASSERT(err <= 0);
     return err;
@@ -590,6 +698,14 @@ static int lfs1_traverse(lfs_t *lfs,
 #endif
 
 static int lfs_dir_rewind_(lfs_t *lfs, lfs_dir_t *dir);
+struct lfs_dir_find_match {
+    lfs_t *lfs;
+    const void *name;
+    lfs_size_t size;
+};
+
+static int lfs_dir_find_match(void *data,
+        lfs_tag_t tag, const void *buffer);
 
 static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size);
@@ -599,6 +715,7 @@ static int lfs_file_close_(lfs_t *lfs, lfs_file_t *file);
 static lfs_soff_t lfs_file_size_(lfs_t *lfs, lfs_file_t *file);
 
 static lfs_ssize_t lfs_fs_size_(lfs_t *lfs);
+static lfs_ssize_t lfs_fs_size_traverse(lfs_t *lfs);
 static int lfs_fs_traverse_(lfs_t *lfs,
         int (*cb)(void *data, lfs_block_t block), void *data,
         bool includeorphans);
@@ -614,6 +731,18 @@ static int lfs_unmount_(lfs_t *lfs);
 //
 // after a checkpoint, the block allocator may realloc any untracked blocks
 static void lfs_alloc_ckpoint(lfs_t *lfs) {
+    // every block passed since the last checkpoint is now either in use or
+    // was dropped, so it can be marked in the freemap
+    if (lfs->freemap.valid) {
+        lfs_block_t passed = lfs->block_count - lfs->lookahead.ckpoint;
+        lfs_block_t end = lfs->lookahead.start + lfs->lookahead.next;
+        for (lfs_block_t i = 1; i <= passed; i++) {
+            lfs_block_t block = (end + lfs->block_count - i)
+                    % lfs->block_count;
+            lfs->freemap.buffer[block / 8] |= 1U << (block % 8);
+        }
+    }
+
     lfs->lookahead.ckpoint = lfs->block_count;
 }
 
@@ -639,6 +768,60 @@ static int lfs_alloc_lookahead(void *p, lfs_block_t block) {
 }
 #endif
 
+#ifndef LFS_READONLY
+static int lfs_alloc_freemap(void *p, lfs_block_t block) {
+    lfs_t *lfs = (lfs_t*)p;
+
+    if (block < lfs->block_count
+            && !(lfs->freemap.buffer[block / 8] & (1U << (block % 8)))) {
+        lfs->freemap.buffer[block / 8] |= 1U << (block % 8);
+        lfs->freemap.free -= 1;
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_alloc_rebuild(lfs_t *lfs) {
+    // blocks allocated since the last checkpoint may not be in the tree yet,
+    // they are the blocks passed since then that a valid map has not marked,
+    // without a valid map keep every passed block
+    lfs_block_t passed = lfs->block_count - lfs->lookahead.ckpoint;
+    lfs_block_t end = lfs->lookahead.start + lfs->lookahead.next;
+    bool valid = lfs->freemap.valid;
+    lfs->freemap.valid = false;
+    lfs->freemap.free = lfs->block_count;
+    for (lfs_block_t i = 1; i <= lfs->block_count; i++) {
+        lfs_block_t block = (end + lfs->block_count - i) % lfs->block_count;
+        uint8_t mask = 1U << (block % 8);
+        if (i <= passed
+                && (!valid || !(lfs->freemap.buffer[block / 8] & mask))) {
+            lfs->freemap.buffer[block / 8] |= mask;
+            lfs->freemap.free -= 1;
+        } else {
+            lfs->freemap.buffer[block / 8] &= ~mask;
+        }
+    }
+
+    // find mask of all in-use blocks from tree
+    int err = lfs_fs_traverse_(lfs, lfs_alloc_freemap, lfs, true);
+    if (err) {
+        return err;
+    }
+
+    lfs->freemap.valid = true;
+
+    // with the blocks in flight marked the allocator may go around again,
+    // as long as there is something left to find
+    if (valid && lfs->freemap.free > 0) {
+        lfs->lookahead.ckpoint = lfs->block_count;
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_alloc_scan(lfs_t *lfs) {
     // move lookahead buffer to the first unused block
@@ -652,8 +835,30 @@ static int lfs_alloc_scan(lfs_t *lfs) {
             8*lfs->cfg->lookahead_size,
             lfs->lookahead.ckpoint);
 
-    // find mask of free blocks from tree
     memset(lfs->lookahead.buffer, 0, lfs->cfg->lookahead_size);
+    if (lfs->freemap.buffer) {
+        // the freemap only ever marks more blocks than are in use, so we
+        // only need to traverse the tree when it has run out of free blocks
+        if (!lfs->freemap.valid || lfs->freemap.free == 0) {
+            int err = lfs_alloc_rebuild(lfs);
+            if (err) {
+                lfs_alloc_drop(lfs);
+                return err;
+            }
+        }
+
+        for (lfs_block_t off = 0; off < lfs->lookahead.size; off++) {
+            lfs_block_t block = (lfs->lookahead.start + off)
+                    % lfs->block_count;
+            if (lfs->freemap.buffer[block / 8] & (1U << (block % 8))) {
+                lfs->lookahead.buffer[off / 8] |= 1U << (off % 8);
+            }
+        }
+
+        return 0;
+    }
+
+    // find mask of free blocks from tree
     int err = lfs_fs_traverse_(lfs, lfs_alloc_lookahead, lfs, true);
     if (err) {
         lfs_alloc_drop(lfs);
@@ -664,6 +869,21 @@ static int lfs_alloc_scan(lfs_t *lfs) {
 }
 #endif
 
+#ifndef LFS_READONLY
+// keep the used block count up to date once lfs_fs_size has taken it
+static void lfs_used_add(lfs_t *lfs, lfs_ssize_t delta) {
+    if (lfs->used >= 0) {
+        lfs->used += delta;
+    }
+}
+
+// a failed operation may leave blocks it allocated unused, so the next
+// lfs_fs_size counts them again
+static void lfs_used_recount(lfs_t *lfs) {
+    lfs->used = -1;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
@@ -674,6 +894,11 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
                 // found a free block
                 *block = (lfs->lookahead.start + lfs->lookahead.next)
                         % lfs->block_count;
+                // the freemap marks it at the next checkpoint
+                if (lfs->freemap.valid) {
+                    lfs->freemap.free -= 1;
+                }
+                lfs_used_add(lfs, 1);
 
                 // eagerly find next free block to maximize how many blocks
                 // lfs_alloc_ckpoint makes available for scanning
@@ -700,10 +925,23 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
         // If we've looked at all blocks since the last checkpoint, we report
         // the filesystem as out of storage.
         //
+        // With a freemap, blocks freed since it was built are only found by
+        // rebuilding it, which restarts the search if it finds any.
+        //
+        if (lfs->lookahead.ckpoint <= 0 && lfs->freemap.valid) {
+            int err = lfs_alloc_rebuild(lfs);
+            if (err) {
+                lfs_alloc_drop(lfs);
+                lfs_used_recount(lfs);
+                return err;
+            }
+        }
+
         if (lfs->lookahead.ckpoint <= 0) {
             LFS_ERROR("No more free space 0x%"PRIx32,
                     (lfs->lookahead.start + lfs->lookahead.next)
                         % lfs->block_count);
+            lfs_used_recount(lfs);
             return LFS_ERR_NOSPC;
         }
 
@@ -711,6 +949,7 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
         // unused blocks in the next lookahead window.
         int err = lfs_alloc_scan(lfs);
         if(err) {
+            lfs_used_recount(lfs);
             return err;
         }
     }
@@ -1107,6 +1346,254 @@ popped:
 }
 #endif
 
+/// Name index ///
+
+// names are indexed while lfs_dir_find scans a pair, the index tracks ids
+// through splices the same way lfs_dir_fetchmatch tracks its count
+struct lfs_nindex_build {
+    struct lfs_nindex_entry *entries;
+    lfs_size_t cap;
+    lfs_size_t count;
+    lfs_off_t last;
+};
+
+#if LFS_NAME_INDEX
+static const struct lfs_nindex_pair *lfs_nindex_get(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+    lfs_size_t off = 0;
+    while (off < lfs->nindex.used) {
+        const struct lfs_nindex_pair *p
+                = (const void*)&lfs->nindex.buffer[off];
+        if (lfs_pair_issync(p->m.pair, pair)) {
+            return p;
+        }
+        off += lfs_nindex_size(p->count);
+    }
+
+    return NULL;
+}
+#endif
+
+static void lfs_nindex_begin(lfs_t *lfs, struct lfs_nindex_build *build,
+        const lfs_block_t pair[2]) {
+    build->entries = NULL;
+    build->cap = 0;
+    build->count = 0;
+    build->last = 0;
+#if LFS_NAME_INDEX
+    struct lfs_nindex *nindex = &lfs->nindex;
+    if (!pair || !nindex->buffer || lfs_nindex_get(lfs, pair)) {
+        return;
+    }
+
+    // out of room? keep what we have, starting over here would just thrash
+    // on directories spanning more pairs than we can index
+    if (nindex->size - nindex->used <= lfs_nindex_size(0)) {
+        return;
+    }
+
+    build->entries = (void*)&nindex->buffer[
+            nindex->used + lfs_nindex_size(0)];
+    build->cap = (nindex->size - nindex->used - lfs_nindex_size(0))
+            / sizeof(struct lfs_nindex_entry);
+#else
+    (void)lfs;
+    (void)pair;
+#endif
+}
+
+static int lfs_nindex_update(lfs_t *lfs, struct lfs_nindex_build *build,
+        lfs_block_t block, lfs_off_t off, lfs_tag_t tag) {
+#if LFS_NAME_INDEX
+    if (!build->entries) {
+        return 0;
+    }
+
+    uint16_t id = lfs_tag_id(tag);
+    struct lfs_nindex_entry *e = build->entries;
+    if (lfs_tag_type1(tag) == LFS_TYPE_NAME) {
+        if (id >= build->count) {
+            if (id >= build->cap) {
+                build->entries = NULL;
+                return 0;
+            }
+            memset(&e[build->count], 0,
+                    (id+1 - build->count)*sizeof(*e));
+            build->count = id+1;
+        }
+
+        e[id].tag = 0;
+        if ((LFS_MKTAG(0x780, 0, 0) & tag) == LFS_MKTAG(LFS_TYPE_NAME, 0, 0)) {
+            uint32_t hash = 0xffffffff;
+            int err = lfs_bd_crc(lfs,
+                    NULL, &lfs->rcache, lfs->cfg->block_size,
+                    block, off+sizeof(tag), lfs_tag_size(tag), &hash);
+            if (err) {
+                return err;
+            }
+
+            e[id].tag = tag;
+            e[id].off = off+sizeof(tag);
+            e[id].hash = hash;
+        }
+    } else if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+        if (lfs_tag_splice(tag) > 0 && id <= build->count
+                && build->count < build->cap) {
+            memmove(&e[id+1], &e[id], (build->count - id)*sizeof(*e));
+            e[id].tag = 0;
+            build->count += 1;
+        } else if (lfs_tag_splice(tag) < 0 && id < build->count) {
+            memmove(&e[id], &e[id+1], (build->count - id-1)*sizeof(*e));
+            build->count -= 1;
+        } else {
+            build->entries = NULL;
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+
+    build->last = off;
+#else
+    (void)lfs;
+    (void)build;
+    (void)block;
+    (void)off;
+    (void)tag;
+#endif
+    return 0;
+}
+
+static void lfs_nindex_end(lfs_t *lfs, struct lfs_nindex_build *build,
+        const lfs_mdir_t *dir) {
+#if LFS_NAME_INDEX
+    // only keep what we found in valid commits
+    if (!build->entries || build->last >= dir->off
+            || build->count != dir->count) {
+        return;
+    }
+
+    struct lfs_nindex *nindex = &lfs->nindex;
+    struct lfs_nindex_pair *p = (void*)&nindex->buffer[nindex->used];
+    const struct lfs_nindex_entry *e = build->entries;
+    lfs_size_t last = build->count;
+    while (last > 0 && !e[last-1].tag) {
+        last -= 1;
+    }
+
+    memset(p->last, 0, sizeof(p->last));
+    if (last > 0) {
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                dir->pair[0], e[last-1].off, p->last,
+                lfs_min(lfs_tag_size(e[last-1].tag), sizeof(p->last)));
+        if (err) {
+            return;
+        }
+    }
+
+    p->m = *dir;
+    p->count = build->count;
+    nindex->used += lfs_nindex_size(build->count);
+#else
+    (void)lfs;
+    (void)build;
+    (void)dir;
+#endif
+}
+
+// find an existing name through the index, returns 0 if the pair must be
+// scanned, or LFS_ERR_NOENT with dir set to the pair if the name isn't in
+// it, every name in it sorts before it and the directory continues in its
+// tail
+static lfs_stag_t lfs_nindex_find(lfs_t *lfs, lfs_mdir_t *dir,
+        const lfs_block_t pair[2], const void *name, lfs_size_t size,
+        uint16_t *id) {
+#if LFS_NAME_INDEX
+    const struct lfs_nindex_pair *p = lfs_nindex_get(lfs, pair);
+    if (!p || lfs_gstate_hasmovehere(&lfs->gdisk, p->m.pair)) {
+        return 0;
+    }
+
+    uint32_t hash = lfs_crc(0xffffffff, name, size);
+    const struct lfs_nindex_entry *e = (const void*)&p[1];
+    for (lfs_size_t i = 0; i < p->count; i++) {
+        if (!e[i].tag || e[i].hash != hash
+                || lfs_tag_size(e[i].tag) != size) {
+            continue;
+        }
+
+        int res = lfs_bd_cmp(lfs,
+                NULL, &lfs->rcache, size,
+                p->m.pair[0], e[i].off, name, size);
+        if (res < 0) {
+            return res;
+        }
+
+        if (res == LFS_CMP_EQ) {
+            *dir = p->m;
+            if (id) {
+                *id = i;
+            }
+            return (e[i].tag & ~LFS_MKTAG(0, 0x3ff, 0)) | LFS_MKTAG(0, i, 0);
+        }
+    }
+
+    // misses in the last pair still need a scan to find where the name
+    // would be inserted
+    if (!p->m.split) {
+        return 0;
+    }
+
+    // names are kept sorted by id, so the pair can only be skipped if its
+    // last name sorts before ours, otherwise the scan stops here with the
+    // insertion id
+    lfs_size_t last = p->count;
+    while (last > 0 && !e[last-1].tag) {
+        last -= 1;
+    }
+
+    if (last > 0) {
+        // compare with the start of the name we kept, only going to disk
+        // if that doesn't settle it
+        lfs_size_t lsize = lfs_tag_size(e[last-1].tag);
+        lfs_size_t diff = lfs_min(lfs_min(size, lsize), sizeof(p->last));
+        int cmp = memcmp(p->last, name, diff);
+        int res;
+        if (cmp != 0) {
+            res = (cmp < 0) ? LFS_CMP_LT : LFS_CMP_GT;
+        } else if (diff == lfs_min(size, lsize)) {
+            res = (lsize < size) ? LFS_CMP_LT
+                    : (lsize > size) ? LFS_CMP_GT
+                    : LFS_CMP_EQ;
+        } else {
+            res = lfs_dir_find_match(
+                    &(struct lfs_dir_find_match){lfs, name, size},
+                    e[last-1].tag,
+                    &(struct lfs_diskoff){p->m.pair[0], e[last-1].off});
+            if (res < 0) {
+                return res;
+            }
+        }
+
+        if (res != LFS_CMP_LT) {
+            return 0;
+        }
+    }
+
+    *dir = p->m;
+    return LFS_ERR_NOENT;
+#else
+    (void)lfs;
+    (void)dir;
+    (void)pair;
+    (void)name;
+    (void)size;
+    (void)id;
+#endif
+    return 0;
+}
+
 static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         lfs_mdir_t *dir, const lfs_block_t pair[2],
         lfs_tag_t fmask, lfs_tag_t ftag, uint16_t *id,
@@ -1122,10 +1609,14 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         return LFS_ERR_CORRUPT;
     }
 
+    // a cached pair is unchanged since it was last fetched, so we already
+    // know which block is current and that its commits are valid
+    const lfs_mdir_t *cached = lfs_mcache_find(lfs, pair);
+
     // find the block with the most recent revision
     uint32_t revs[2] = {0, 0};
     int r = 0;
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < 2 && !cached; i++) {
         int err = lfs_bd_read(lfs,
                 NULL, &lfs->rcache, sizeof(revs[i]),
                 pair[i], 0, &revs[i], sizeof(revs[i]));
@@ -1144,6 +1635,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
     dir->pair[1] = pair[(r+1)%2];
     dir->rev = revs[(r+0)%2];
     dir->off = 0; // nonzero = found some commits
+    if (cached) {
+        *dir = *cached;
+    }
 
     // now scan tags to fetch the actual dir and find possible match
     for (int i = 0; i < 2; i++) {
@@ -1160,6 +1654,11 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         bool hasfcrc = false;
         struct lfs_fcrc fcrc;
 
+        // index names while we're looking one up
+        struct lfs_nindex_build build;
+        lfs_nindex_begin(lfs,
+                &build, (cb == lfs_dir_find_match) ? pair : NULL);
+
         dir->rev = lfs_tole32(dir->rev);
         uint32_t crc = lfs_crc(0xffffffff, &dir->rev, sizeof(dir->rev));
         dir->rev = lfs_fromle32(dir->rev);
@@ -1168,6 +1667,10 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             // extract next tag
             lfs_tag_t tag;
             off += lfs_tag_dsize(ptag);
+            // cached pairs only need scanning if we're looking for a match
+            if (cached && (!cb || off >= cached->off)) {
+                break;
+            }
             int err = lfs_bd_read(lfs,
                     NULL, &lfs->rcache, lfs->cfg->block_size,
                     dir->pair[0], off, &tag, sizeof(tag));
@@ -1195,32 +1698,35 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             ptag = tag;
 
             if (lfs_tag_type2(tag) == LFS_TYPE_CCRC) {
-                // check the crc attr
-                uint32_t dcrc;
-                err = lfs_bd_read(lfs,
-                        NULL, &lfs->rcache, lfs->cfg->block_size,
-                        dir->pair[0], off+sizeof(tag), &dcrc, sizeof(dcrc));
-                if (err) {
-                    if (err == LFS_ERR_CORRUPT) {
+                if (!cached) {
+                    // check the crc attr
+                    uint32_t dcrc;
+                    err = lfs_bd_read(lfs,
+                            NULL, &lfs->rcache, lfs->cfg->block_size,
+                            dir->pair[0], off+sizeof(tag),
+                            &dcrc, sizeof(dcrc));
+                    if (err) {
+                        if (err == LFS_ERR_CORRUPT) {
+                            break;
+                        }
+                        return err;
+                    }
+                    dcrc = lfs_fromle32(dcrc);
+
+                    if (crc != dcrc) {
                         break;
                     }
-                    return err;
-                }
-                dcrc = lfs_fromle32(dcrc);
 
-                if (crc != dcrc) {
-                    break;
+                    // toss our crc into the filesystem seed for
+                    // pseudorandom numbers, note we use another crc here
+                    // as a collection function because it is sufficiently
+                    // random and convenient
+                    lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
                 }
 
                 // reset the next bit if we need to
                 ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
 
-                // toss our crc into the filesystem seed for
-                // pseudorandom numbers, note we use another crc here
-                // as a collection function because it is sufficiently
-                // random and convenient
-                lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
-
                 // update with what's found so far
                 besttag = tempbesttag;
                 dir->off = off + lfs_tag_dsize(tag);
@@ -1236,10 +1742,20 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
 
             // crc the entry first, hopefully leaving it in the cache
-            err = lfs_bd_crc(lfs,
-                    NULL, &lfs->rcache, lfs->cfg->block_size,
-                    dir->pair[0], off+sizeof(tag),
-                    lfs_tag_dsize(tag)-sizeof(tag), &crc);
+            if (!cached) {
+                err = lfs_bd_crc(lfs,
+                        NULL, &lfs->rcache, lfs->cfg->block_size,
+                        dir->pair[0], off+sizeof(tag),
+                        lfs_tag_dsize(tag)-sizeof(tag), &crc);
+                if (err) {
+                    if (err == LFS_ERR_CORRUPT) {
+                        break;
+                    }
+                    return err;
+                }
+            }
+
+            err = lfs_nindex_update(lfs, &build, dir->pair[0], off, tag);
             if (err) {
                 if (err == LFS_ERR_CORRUPT) {
                     break;
@@ -1327,7 +1843,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         }
 
         // did we end on a valid commit? we may have an erased block
-        dir->erased = false;
+        if (!cached) {
+            dir->erased = false;
+        }
         if (maybeerased && dir->off % lfs->cfg->prog_size == 0) {
         #ifdef LFS_MULTIVERSION
             // note versions < lfs2.1 did not have fcrc tags, if
@@ -1357,6 +1875,11 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
         }
 
+        if (!cached) {
+            lfs_mcache_insert(lfs, dir);
+        }
+        lfs_nindex_end(lfs, &build, dir);
+
         // synthetic move
         if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair)) {
             if (lfs_tag_id(lfs->gdisk.tag) == lfs_tag_id(besttag)) {
@@ -1446,12 +1969,6 @@ static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
     return 0;
 }
 
-struct lfs_dir_find_match {
-    lfs_t *lfs;
-    const void *name;
-    lfs_size_t size;
-};
-
 static int lfs_dir_find_match(void *data,
         lfs_tag_t tag, const void *buffer) {
     struct lfs_dir_find_match *name = data;
@@ -1567,6 +2084,16 @@ nextname:
 
         // find entry matching name
         while (true) {
+            tag = lfs_nindex_find(lfs, dir, dir->tail, name, namelen, id);
+            if (tag == LFS_ERR_NOENT) {
+                continue;
+            } else if (tag) {
+                if (tag < 0) {
+                    return tag;
+                }
+                break;
+            }
+
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
                     LFS_MKTAG(0x780, 0, 0),
                     LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
@@ -1874,6 +2401,7 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+    lfs_used_add(lfs, -2);
     return 0;
 }
 #endif
@@ -2115,6 +2643,11 @@ relocate:
             return err;
         }
 
+        if (!err) {
+            // the new block replaces the old one
+            lfs_used_add(lfs, -1);
+        }
+
         tired = false;
         continue;
     }
@@ -2200,9 +2733,15 @@ static int lfs_dir_splittingcompact(lfs_t *lfs, lfs_mdir_t *dir,
             && lfs_pair_cmp(dir->pair, (const lfs_block_t[2]){0, 1}) == 0) {
         // oh no! we're writing too much to the superblock,
         // should we expand?
-        lfs_ssize_t size = lfs_fs_size_(lfs);
+        //
+        // a count taken mid-commit may miss blocks we have not linked in
+        // yet, so it is not kept
+        lfs_ssize_t size = lfs->used;
         if (size < 0) {
-            return size;
+            size = lfs_fs_size_traverse(lfs);
+            if (size < 0) {
+                return size;
+            }
         }
 
         // littlefs cannot reclaim expanded superblocks, so expand cautiously
@@ -2466,6 +3005,8 @@ static int lfs_dir_orphaningcommit(lfs_t *lfs, lfs_mdir_t *dir,
             return state;
         }
 
+        // the dropped pair is no longer in use
+        lfs_used_add(lfs, -2);
         ldir = pdir;
     }
 
@@ -2603,6 +3144,7 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
     int orphans = lfs_dir_orphaningcommit(lfs, dir, attrs, attrcount);
     if (orphans < 0) {
+        lfs_used_recount(lfs);
         return orphans;
     }
 
@@ -2612,6 +3154,7 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         // created some
         int err = lfs_fs_deorphan(lfs, false);
         if (err) {
+            lfs_used_recount(lfs);
             return err;
         }
     }
@@ -2884,8 +3427,74 @@ static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off) {
     return i;
 }
 
+#ifndef LFS_READONLY
+// number of blocks in a skip-list holding size bytes
+static lfs_size_t lfs_ctz_count(lfs_t *lfs, lfs_size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    lfs_off_t off = size - 1;
+    return lfs_ctz_index(lfs, &off) + 1;
+}
+#endif
+
+static void lfs_ctzcache_drop(lfs_file_t *file) {
+#if LFS_CTZ_CACHE > 0
+    for (int i = 0; i < LFS_CTZ_CACHE; i++) {
+        file->ctzcache.block[i] = LFS_BLOCK_NULL;
+    }
+#else
+    (void)file;
+#endif
+}
+
+// remember where we found block index of a skip-list ending at index last
+static void lfs_ctzcache_insert(lfs_file_t *file,
+        lfs_off_t last, lfs_off_t index, lfs_block_t block) {
+#if LFS_CTZ_CACHE > 0
+    // spread entries over the whole file so any seek has one close above it,
+    // within an entry's range prefer indices with more trailing zeros, their
+    // pointers skip further back
+    lfs_size_t i = (uint64_t)index*LFS_CTZ_CACHE / (last+1);
+    if (file->ctzcache.block[i] != LFS_BLOCK_NULL
+            && (index == 0 || (file->ctzcache.index[i] != 0
+                && lfs_ctz(index) < lfs_ctz(file->ctzcache.index[i])))) {
+        return;
+    }
+
+    file->ctzcache.index[i] = index;
+    file->ctzcache.block[i] = block;
+#else
+    (void)file;
+    (void)last;
+    (void)index;
+    (void)block;
+#endif
+}
+
+// find the closest known block at or after target, if any
+static void lfs_ctzcache_find(const lfs_file_t *file,
+        lfs_off_t target, lfs_off_t *current, lfs_block_t *head) {
+#if LFS_CTZ_CACHE > 0
+    for (int i = 0; i < LFS_CTZ_CACHE; i++) {
+        if (file->ctzcache.block[i] != LFS_BLOCK_NULL
+                && file->ctzcache.index[i] >= target
+                && file->ctzcache.index[i] < *current) {
+            *current = file->ctzcache.index[i];
+            *head = file->ctzcache.block[i];
+        }
+    }
+#else
+    (void)file;
+    (void)target;
+    (void)current;
+    (void)head;
+#endif
+}
+
 static int lfs_ctz_find(lfs_t *lfs,
-        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_file_t *file,
         lfs_block_t head, lfs_size_t size,
         lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
     if (size == 0) {
@@ -2894,9 +3503,13 @@ static int lfs_ctz_find(lfs_t *lfs,
         return 0;
     }
 
-    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    lfs_off_t last = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    lfs_off_t current = last;
     lfs_off_t target = lfs_ctz_index(lfs, &pos);
 
+    // skip ahead if file has already seen a block closer to our target
+    lfs_ctzcache_find(file, target, &current, &head);
+
     while (current > target) {
         lfs_size_t skip = lfs_min(
                 lfs_npw2(current-target+1) - 1,
@@ -2911,6 +3524,7 @@ static int lfs_ctz_find(lfs_t *lfs,
         }
 
         current -= 1 << skip;
+        lfs_ctzcache_insert(file, last, current, head);
     }
 
     *block = head;
@@ -2972,6 +3586,8 @@ static int lfs_ctz_extend(lfs_t *lfs,
                     }
                 }
 
+                // the copy replaces the last block
+                lfs_used_add(lfs, -1);
                 *block = nblock;
                 *off = noff;
                 return 0;
@@ -3013,6 +3629,7 @@ relocate:
         LFS_DEBUG("Bad block at 0x%"PRIx32, nblock);
 
         // just clear cache and try a new block
+        lfs_used_add(lfs, -1);
         lfs_cache_drop(lfs, pcache);
     }
 }
@@ -3061,6 +3678,53 @@ static int lfs_ctz_traverse(lfs_t *lfs,
     }
 }
 
+#ifndef LFS_READONLY
+// drop blocks a file no longer uses from the used block count, unless
+// another handle has the same file open and may still be using them
+static void lfs_file_dropblocks(lfs_t *lfs, const lfs_file_t *file,
+        const lfs_block_t pair[2], uint16_t id, lfs_size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    for (struct lfs_mlist *p = lfs->mlist; p; p = p->next) {
+        if (p != (const struct lfs_mlist*)file &&
+                p->type == LFS_TYPE_REG &&
+                p->id == id &&
+                lfs_pair_cmp(p->m.pair, pair) == 0) {
+            lfs_used_recount(lfs);
+            return;
+        }
+    }
+
+    lfs_used_add(lfs, -(lfs_ssize_t)count);
+}
+
+// drop the blocks of a file's entry on disk from the used block count
+static int lfs_file_dropentry(lfs_t *lfs, const lfs_file_t *file,
+        lfs_mdir_t *dir, uint16_t id) {
+    if (lfs->used < 0) {
+        // not counted yet
+        return 0;
+    }
+
+    struct lfs_ctz ctz;
+    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_STRUCT, id, 8), &ctz);
+    if (tag < 0) {
+        return tag;
+    }
+    lfs_ctz_fromle32(&ctz);
+
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
+        lfs_file_dropblocks(lfs, file, dir->pair, id,
+                lfs_ctz_count(lfs, ctz.size));
+    }
+
+    return 0;
+}
+#endif
+
 
 /// Top level file operations ///
 static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
@@ -3085,6 +3749,7 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    lfs_ctzcache_drop(file);
 
     // allocate entry for file if it doesn't exist
     lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
@@ -3144,7 +3809,12 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
         goto cleanup;
 #ifndef LFS_READONLY
     } else if (flags & LFS_O_TRUNC) {
-        // truncate if requested
+        // truncate if requested, the old blocks are dropped on sync
+        err = lfs_file_dropentry(lfs, file, &file->m, file->id);
+        if (err) {
+            goto cleanup;
+        }
+
         tag = LFS_MKTAG(LFS_TYPE_INLINESTRUCT, file->id, 0);
         file->flags |= LFS_F_DIRTY;
 #endif
@@ -3230,6 +3900,7 @@ cleanup:
     // clean up lingering resources
 #ifndef LFS_READONLY
     file->flags |= LFS_F_ERRED;
+    lfs_used_recount(lfs);
 #endif
     lfs_file_close_(lfs, file);
     return err;
@@ -3251,6 +3922,13 @@ static int lfs_file_close_(lfs_t *lfs, lfs_file_t *file) {
     int err = 0;
 #endif
 
+#ifndef LFS_READONLY
+    if (file->flags & LFS_F_DIRTY) {
+        // never made it to disk, blocks may be left unused
+        lfs_used_recount(lfs);
+    }
+#endif
+
     // remove from list of mdirs
     lfs_mlist_remove(lfs, (struct lfs_mlist*)file);
 
@@ -3321,6 +3999,10 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
         file->cache.size = lfs->pcache.size;
         lfs_cache_zero(lfs, &lfs->pcache);
 
+        // an inline file had no block to replace
+        if (!(file->flags & LFS_F_INLINE)) {
+            lfs_used_add(lfs, -1);
+        }
         file->block = nblock;
         file->flags |= LFS_F_WRITING;
         return 0;
@@ -3329,6 +4011,7 @@ relocate:
         LFS_DEBUG("Bad block at 0x%"PRIx32, nblock);
 
         // just clear cache and try a new block
+        lfs_used_add(lfs, -1);
         lfs_cache_drop(lfs, &lfs->pcache);
     }
 }
@@ -3369,6 +4052,7 @@ static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
                 .pos = file->pos,
                 .cache = lfs->rcache,
             };
+            lfs_ctzcache_drop(&orig);
             lfs_cache_drop(lfs, &lfs->rcache);
 
             while (file->pos < file->ctz.size) {
@@ -3408,6 +4092,7 @@ relocate:
                 LFS_DEBUG("Bad block at 0x%"PRIx32, file->block);
                 err = lfs_file_relocate(lfs, file);
                 if (err) {
+                    lfs_used_recount(lfs);
                     return err;
                 }
             }
@@ -3418,6 +4103,7 @@ relocate:
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        lfs_ctzcache_drop(file);
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -3438,6 +4124,7 @@ static int lfs_file_sync_(lfs_t *lfs, lfs_file_t *file) {
     int err = lfs_file_flush(lfs, file);
     if (err) {
         file->flags |= LFS_F_ERRED;
+        lfs_used_recount(lfs);
         return err;
     }
 
@@ -3480,6 +4167,7 @@ static int lfs_file_sync_(lfs_t *lfs, lfs_file_t *file) {
                     file->cfg->attr_count), file->cfg->attrs}));
         if (err) {
             file->flags |= LFS_F_ERRED;
+            lfs_used_recount(lfs);
             return err;
         }
 
@@ -3508,7 +4196,7 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
+                int err = lfs_ctz_find(lfs, NULL, &file->cache, file,
                         file->ctz.head, file->ctz.size,
                         file->pos, &file->block, &file->off);
                 if (err) {
@@ -3534,9 +4222,11 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
                 return err;
             }
         } else {
+            lfs->data_read = true;
             int err = lfs_bd_read(lfs,
                     NULL, &file->cache, lfs->cfg->block_size,
                     file->block, file->off, data, diff);
+            lfs->data_read = false;
             if (err) {
                 return err;
             }
@@ -3581,6 +4271,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
         int err = lfs_file_outline(lfs, file);
         if (err) {
             file->flags |= LFS_F_ERRED;
+            lfs_used_recount(lfs);
             return err;
         }
     }
@@ -3590,13 +4281,21 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_WRITING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
+                if (!(file->flags & LFS_F_WRITING)) {
+                    // blocks past the one we extend from are dropped
+                    lfs_file_dropblocks(lfs, file, file->m.pair, file->id,
+                            lfs_ctz_count(lfs, file->ctz.size)
+                                - lfs_ctz_count(lfs, file->pos));
+                }
+
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
-                    int err = lfs_ctz_find(lfs, NULL, &file->cache,
+                    int err = lfs_ctz_find(lfs, NULL, &file->cache, file,
                             file->ctz.head, file->ctz.size,
                             file->pos-1, &file->block, &(lfs_off_t){0});
                     if (err) {
                         file->flags |= LFS_F_ERRED;
+                        lfs_used_recount(lfs);
                         return err;
                     }
 
@@ -3611,6 +4310,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
                         &file->block, &file->off);
                 if (err) {
                     file->flags |= LFS_F_ERRED;
+                    lfs_used_recount(lfs);
                     return err;
                 }
             } else {
@@ -3631,6 +4331,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
                     goto relocate;
                 }
                 file->flags |= LFS_F_ERRED;
+                lfs_used_recount(lfs);
                 return err;
             }
 
@@ -3639,6 +4340,7 @@ relocate:
             err = lfs_file_relocate(lfs, file);
             if (err) {
                 file->flags |= LFS_F_ERRED;
+                lfs_used_recount(lfs);
                 return err;
             }
         }
@@ -3777,8 +4479,14 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
                 return (int)res;
             }
 
+            if (!(file->flags & LFS_F_INLINE)) {
+                lfs_file_dropblocks(lfs, file, file->m.pair, file->id,
+                        lfs_ctz_count(lfs, file->ctz.size));
+            }
+
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
+            lfs_ctzcache_drop(file);
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
             file->cache.block = file->ctz.head;
             file->cache.off = 0;
@@ -3793,18 +4501,23 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             }
 
             // lookup new head in ctz skip list
-            err = lfs_ctz_find(lfs, NULL, &file->cache,
+            err = lfs_ctz_find(lfs, NULL, &file->cache, file,
                     file->ctz.head, file->ctz.size,
                     size-1, &file->block, &(lfs_off_t){0});
             if (err) {
                 return err;
             }
 
+            lfs_file_dropblocks(lfs, file, file->m.pair, file->id,
+                    lfs_ctz_count(lfs, file->ctz.size)
+                        - lfs_ctz_count(lfs, size));
+
             // need to set pos/block/off consistently so seeking back to
             // the old position does not get confused
             file->pos = size;
             file->ctz.head = file->block;
             file->ctz.size = size;
+            lfs_ctzcache_drop(file);
             file->flags |= LFS_F_DIRTY | LFS_F_READING;
         }
     } else if (size > oldsize) {
@@ -3923,6 +4636,12 @@ static int lfs_remove_(lfs_t *lfs, const char *path) {
         dir.type = 0;
         dir.id = 0;
         lfs->mlist = &dir;
+    } else {
+        // a removed file takes its blocks with it
+        err = lfs_file_dropentry(lfs, NULL, &cwd, lfs_tag_id(tag));
+        if (err) {
+            return err;
+        }
     }
 
     // delete the entry
@@ -4043,6 +4762,12 @@ static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
         prevdir.type = 0;
         prevdir.id = 0;
         lfs->mlist = &prevdir;
+    } else {
+        // a replaced file takes its blocks with it
+        err = lfs_file_dropentry(lfs, NULL, &newcwd, newid);
+        if (err) {
+            return err;
+        }
     }
 
     if (!samepair) {
@@ -4304,6 +5029,25 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         }
     }
 
+    // the used block count is taken by the first lfs_fs_size
+    lfs->used = -1;
+    lfs->data_read = false;
+#if LFS_MDIR_CACHE > 0
+    lfs->mcache_count = 0;
+#endif
+#if LFS_NAME_INDEX
+    // records are accessed as words
+    LFS_ASSERT((uintptr_t)lfs->cfg->name_index_buffer % 4 == 0);
+    lfs->nindex.buffer = lfs->cfg->name_index_buffer;
+    lfs->nindex.size = lfs->cfg->name_index_size;
+    lfs->nindex.used = 0;
+#endif
+
+    // the freemap is built by the first lookahead scan
+    lfs->freemap.buffer = lfs->cfg->freemap_buffer;
+    lfs->freemap.valid = false;
+    lfs->freemap.free = 0;
+
     // check that the size limits are sane
     LFS_ASSERT(lfs->cfg->name_max <= LFS_NAME_MAX);
     lfs->name_max = lfs->cfg->name_max;
@@ -5057,6 +5801,7 @@ static int lfs_fs_deorphan(lfs_t *lfs, bool powerloss) {
                                     pair}));
                         lfs_pair_fromle32(pair);
                         if (state < 0) {
+                            lfs_used_recount(lfs);
                             return state;
                         }
 
@@ -5091,9 +5836,13 @@ static int lfs_fs_deorphan(lfs_t *lfs, bool powerloss) {
                                 dir.tail}));
                     lfs_pair_fromle32(dir.tail);
                     if (state < 0) {
+                        lfs_used_recount(lfs);
                         return state;
                     }
 
+                    // the orphan is no longer in use
+                    lfs_used_add(lfs, -2);
+
                     // did our commit create more orphans?
                     if (state == LFS_OK_ORPHANED) {
                         moreorphans = true;
@@ -5173,7 +5922,7 @@ static int lfs_fs_size_count(void *p, lfs_block_t block) {
     return 0;
 }
 
-static lfs_ssize_t lfs_fs_size_(lfs_t *lfs) {
+static lfs_ssize_t lfs_fs_size_traverse(lfs_t *lfs) {
     lfs_size_t size = 0;
     int err = lfs_fs_traverse_(lfs, lfs_fs_size_count, &size, false);
     if (err) {
@@ -5183,6 +5932,33 @@ static lfs_ssize_t lfs_fs_size_(lfs_t *lfs) {
     return size;
 }
 
+static lfs_ssize_t lfs_fs_size_(lfs_t *lfs) {
+    // once taken, the count is kept up to date as blocks are allocated
+    // and dropped
+    if (lfs->used >= 0) {
+        return lfs->used;
+    }
+
+    lfs_ssize_t size = lfs_fs_size_traverse(lfs);
+    if (size < 0) {
+        return size;
+    }
+
+#ifndef LFS_READONLY
+    // a file being written is counted with both its old and new blocks,
+    // only keep a count of settled files
+    for (struct lfs_mlist *p = lfs->mlist; p; p = p->next) {
+        if (p->type == LFS_TYPE_REG &&
+                (((lfs_file_t*)p)->flags & (LFS_F_DIRTY | LFS_F_WRITING))) {
+            return size;
+        }
+    }
+#endif
+
+    lfs->used = size;
+    return size;
+}
+
 // explicit garbage collection
 #ifndef LFS_READONLY
 static int lfs_fs_gc_(lfs_t *lfs) {
@@ -5234,6 +6010,43 @@ static int lfs_fs_gc_(lfs_t *lfs) {
 }
 #endif
 
+#ifndef LFS_READONLY
+static lfs_ssize_t lfs_fs_freemap_(lfs_t *lfs) {
+    if (!lfs->freemap.buffer) {
+        return LFS_ERR_INVAL;
+    }
+
+    // between operations every block allocated since the last checkpoint is
+    // committed, so a checkpoint brings the map up to date
+    if (!lfs->freemap.valid) {
+        int err = lfs_alloc_rebuild(lfs);
+        if (err) {
+            return err;
+        }
+    }
+    lfs_alloc_ckpoint(lfs);
+
+    return lfs->freemap.free;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_next_free_(lfs_t *lfs, lfs_size_t n, lfs_block_t *block) {
+    // same order as lfs_alloc hands them out
+    for (lfs_block_t i = lfs->lookahead.next; i < lfs->lookahead.size; i++) {
+        if (!(lfs->lookahead.buffer[i / 8] & (1U << (i % 8)))) {
+            if (n == 0) {
+                *block = (lfs->lookahead.start + i) % lfs->block_count;
+                return 0;
+            }
+            n -= 1;
+        }
+    }
+
+    return LFS_ERR_NOSPC;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_fs_grow_(lfs_t *lfs, lfs_size_t block_count) {
     // shrinking is not supported
@@ -5241,6 +6054,7 @@ static int lfs_fs_grow_(lfs_t *lfs, lfs_size_t block_count) {
 
     if (block_count > lfs->block_count) {
         lfs->block_count = block_count;
+        lfs->freemap.valid = false;
 
         // fetch the root
         lfs_mdir_t root;
@@ -6471,6 +7285,43 @@ int lfs_fs_gc(lfs_t *lfs) {
 }
 #endif
 
+#ifndef LFS_READONLY
+lfs_ssize_t lfs_fs_freemap(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_freemap(%p)", (void*)lfs);
+
+    lfs_ssize_t res = lfs_fs_freemap_(lfs);
+
+    LFS_TRACE("lfs_fs_freemap -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_fs_next_free(lfs_t *lfs, lfs_size_t n, lfs_block_t *block) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_next_free(%p, %"PRIu32", %p)",
+            (void*)lfs, n, (void*)block);
+
+    err = lfs_fs_next_free_(lfs, n, block);
+
+    LFS_TRACE("lfs_fs_next_free -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+bool lfs_fs_data_read(const lfs_t *lfs) {
+    return lfs->data_read;
+}
+
 #ifndef LFS_READONLY
 int lfs_fs_grow(lfs_t *lfs, lfs_size_t block_count) {
     int err = LFS_LOCK(lfs->cfg);
@@ -65,6 +65,29 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Number of fetched metadata pairs kept in RAM, most recently used first. A
+// fetch of a cached pair skips reading both revisions and checksumming every
+// commit, and a plain fetch doesn't read the pair at all. Entries are dropped
+// when either block is written. Costs sizeof(lfs_mdir_t) per entry in lfs_t.
+// Disabled (0) by default, define it to e.g. 8 to enable.
+#ifndef LFS_MDIR_CACHE
+#define LFS_MDIR_CACHE 0
+#endif
+
+// Index names of searched metadata pairs in name_index_buffer. Compiled out
+// (0) by default, define it to 1 to enable the index.
+#ifndef LFS_NAME_INDEX
+#define LFS_NAME_INDEX 0
+#endif
+
+// Number of blocks each open file remembers the location of, so seeks can
+// walk the file's skip-list from the nearest known block instead of from the
+// end of the file. Costs 8 bytes per entry per file. Disabled (0) by
+// default, define it to e.g. 8 to enable.
+#ifndef LFS_CTZ_CACHE
+#define LFS_CTZ_CACHE 0
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -283,6 +306,29 @@ struct lfs_config {
     // Set to -1 to disable inlined files.
     lfs_size_t inline_max;
 
+    // Optional statically allocated buffer for a map of in-use blocks. Must
+    // be (block_count+7)/8 bytes, for the largest block_count passed to
+    // lfs_fs_grow. When set, the lookahead buffer is refilled from this map
+    // instead of traversing the filesystem, and the map is only rebuilt with
+    // a traversal once it runs out of free blocks. Blocks are marked at the
+    // checkpoint after they are allocated and only cleared by a rebuild, so
+    // blocks freed since then are not reused until the map runs out. Disabled
+    // when NULL.
+    void *freemap_buffer;
+
+    // Optional statically allocated buffer for an index of the names in
+    // searched metadata pairs, 44 bytes per pair plus 12 bytes per name,
+    // must be 32-bit aligned. Looking up a name in an indexed pair reads just
+    // that name instead of scanning the pair. A pair is indexed while it is
+    // searched, as long as there is room, and dropped when it is written.
+    // Size it for the largest directory to make lookups in it independent of
+    // where the name is. Disabled when NULL, ignored unless LFS_NAME_INDEX
+    // is set.
+    void *name_index_buffer;
+
+    // Size of name_index_buffer in bytes.
+    lfs_size_t name_index_size;
+
 #ifdef LFS_MULTIVERSION
     // On-disk version to use when writing in the form of 16-bit major version
     // + 16-bit minor version. This limiting metadata to what is supported by
@@ -408,6 +454,14 @@ typedef struct lfs_file {
         lfs_size_t size;
     } ctz;
 
+#if LFS_CTZ_CACHE > 0
+    // blocks of ctz found so far, entry i covers an i'th of the file
+    struct lfs_ctzcache {
+        lfs_off_t index[LFS_CTZ_CACHE];
+        lfs_block_t block[LFS_CTZ_CACHE];   // LFS_BLOCK_NULL if unused
+    } ctzcache;
+#endif
+
     uint32_t flags;
     lfs_off_t pos;
     lfs_block_t block;
@@ -457,6 +511,28 @@ typedef struct lfs {
         uint8_t *buffer;
     } lookahead;
 
+    lfs_ssize_t used;
+    bool data_read;
+
+#if LFS_MDIR_CACHE > 0
+    lfs_mdir_t mcache[LFS_MDIR_CACHE];
+    lfs_size_t mcache_count;
+#endif
+
+#if LFS_NAME_INDEX
+    struct lfs_nindex {
+        uint8_t *buffer;
+        lfs_size_t size;
+        lfs_size_t used;
+    } nindex;
+#endif
+
+    struct lfs_freemap {
+        uint8_t *buffer;
+        bool valid;
+        lfs_block_t free;
+    } freemap;
+
     const struct lfs_config *cfg;
     lfs_size_t block_count;
     lfs_size_t name_max;
@@ -720,6 +796,9 @@ int lfs_fs_stat(lfs_t *lfs, struct lfs_fsinfo *fsinfo);
 // Note: Result is best effort. If files share COW structures, the returned
 // size may be larger than the filesystem actually is.
 //
+// The first call walks the filesystem, later calls return the count kept up
+// to date as blocks are allocated and dropped.
+//
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 
@@ -762,6 +841,32 @@ int lfs_fs_mkconsistent(lfs_t *lfs);
 int lfs_fs_gc(lfs_t *lfs);
 #endif
 
+#ifndef LFS_READONLY
+// Brings the map of in-use blocks in freemap_buffer up to date, building it
+// with a traversal if there is none yet, e.g. before saving it. Call it
+// between operations.
+//
+// Returns the number of free blocks in the map, or a negative error code on
+// failure.
+lfs_ssize_t lfs_fs_freemap(lfs_t *lfs);
+#endif
+
+#ifndef LFS_READONLY
+// Finds the free block the allocator will hand out after skipping n free
+// blocks, looking only at the current lookahead window, e.g. to erase it
+// ahead of time. It does not scan for more free blocks.
+//
+// Returns LFS_ERR_NOSPC if the window holds n or fewer free blocks, or a
+// negative error code on failure.
+int lfs_fs_next_free(lfs_t *lfs, lfs_size_t n, lfs_block_t *block);
+#endif
+
+// Returns true while the block device read in progress fetches file data
+// from a CTZ block, false for metadata and everything else. Meant for the
+// block device callbacks, e.g. to only read ahead on file data, so it does
+// not take the lock.
+bool lfs_fs_data_read(const lfs_t *lfs);
+
 #ifndef LFS_READONLY
 // Grows the filesystem to a new size, updating the superblock with the new
 // block count.
@@ -9,73 +9,507 @@
 #include "main.h"
 #include "lfs.h"
 #include "w25qxx.h"
+#include "w25qxx_array.h"
+#include "w25qxx_partition.h"
 #include "w25qxx_littlefs.h"
+#include <stddef.h>
+#include <string.h>
 
 int littlefs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size);
 int littlefs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size);
 int littlefs_erase(const struct lfs_config *c, lfs_block_t block);
 int littlefs_sync(const struct lfs_config *c);
 
-struct lfs_config littlefs_config = {
-    // block device operations
-    .read  = littlefs_read,
-    .prog  = littlefs_prog,
-    .erase = littlefs_erase,
-    .sync  = littlefs_sync,
-
+static const struct lfs_config littlefs_defaults = {
     // block device configuration
     .read_size = 256,
     .prog_size = 256,
-    .block_size = 4096,
-    .block_count = 256,
     .cache_size = 256,
     .lookahead_size = 8,
     .block_cycles = 100,
 };
 
-lfs_t littlefs;
-W25QXX_HandleTypeDef *w25qxx_handle;
+#ifdef W25QXX_LITTLEFS_STATS
+#define LFS_STAT_BEGIN() uint32_t stat_start = W25QXX_LITTLEFS_STATS_TIME()
+#define LFS_STAT_END(fs, op, bytes) littlefs_stat_add(&(fs)->stats.op, W25QXX_LITTLEFS_STATS_TIME() - stat_start, bytes)
+
+static void littlefs_stat_add(W25QXX_littlefs_op_stats_t *op, uint32_t time, lfs_size_t bytes) {
+	uint32_t bucket = 0;
+	while (bucket < W25QXX_LITTLEFS_STATS_BUCKETS - 1 && time >= (1UL << bucket)) ++bucket;
+
+	if (!op->count || time < op->time_min) op->time_min = time;
+	if (time > op->time_max) op->time_max = time;
+	++op->count;
+	op->bytes += bytes;
+	op->time_total += time;
+	++op->histogram[bucket];
+}
+#else
+#define LFS_STAT_BEGIN()
+#define LFS_STAT_END(fs, op, bytes)
+#endif
+
+/*
+ * Raw device access, addresses are relative to the start of the filesystem
+ */
+static int littlefs_dev_read(W25QXX_LittleFSTypeDef *fs, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+	uint32_t address = fs->offset + block * fs->config.block_size + off;
+	W25QXX_result_t ret = fs->array ? w25qxx_array_read(fs->array, address, buffer, size) : w25qxx_read(fs->w25qxx, address, buffer, size);
+	return ret == W25QXX_Ok ? 0 : -1;
+}
+
+static int littlefs_dev_write(W25QXX_LittleFSTypeDef *fs, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+	uint32_t address = fs->offset + block * fs->config.block_size + off;
+	W25QXX_result_t ret = fs->array ? w25qxx_array_write(fs->array, address, (void *)buffer, size) : w25qxx_write(fs->w25qxx, address, (void *)buffer, size);
+	return ret == W25QXX_Ok ? 0 : -1;
+}
+
+static int littlefs_dev_erase(W25QXX_LittleFSTypeDef *fs, lfs_block_t block) {
+#ifdef W25QXX_LITTLEFS_STATS
+	if (block < fs->stats.block_erases_len && fs->stats.block_erases[block] < 0xFFFF) ++fs->stats.block_erases[block];
+#endif
+	uint32_t address = fs->offset + block * fs->config.block_size;
+	W25QXX_result_t ret = fs->array ? w25qxx_array_erase(fs->array, address, fs->config.block_size) : w25qxx_erase(fs->w25qxx, address, fs->config.block_size);
+	return ret == W25QXX_Ok ? 0 : -1;
+}
+
+#define LITTLEFS_FREEMAP_MAGIC   0x4d463257 // "W2FM"
+#define LITTLEFS_FREEMAP_VERSION 1
+
+/*
+ * Header of the saved map in the reserved block, the map follows it.  magic is
+ * programmed last so a torn save is never valid, invalid is programmed to 0
+ * (no erase needed) before the filesystem changes.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t invalid;
+	uint32_t version;
+	uint32_t block_count;
+	uint32_t free;
+	uint32_t crc;
+} littlefs_freemap_header_t;
+
+#ifdef W25QXX_LITTLEFS_FREEMAP
+
+/*
+ * Check the saved map and return its free block count, or -1
+ */
+static int32_t littlefs_freemap_check(W25QXX_LittleFSTypeDef *fs) {
+	littlefs_freemap_header_t header;
+	lfs_size_t len = (fs->config.block_count + 7) / 8;
+
+	if (littlefs_dev_read(fs, fs->config.block_count, 0, &header, sizeof(header))) return -1;
+	if (header.magic != LITTLEFS_FREEMAP_MAGIC || header.invalid != 0xFFFFFFFF || header.version != LITTLEFS_FREEMAP_VERSION
+			|| header.block_count != fs->config.block_count) return -1;
+	if (littlefs_dev_read(fs, fs->config.block_count, sizeof(header), fs->freemap, len)) return -1;
+	if (lfs_crc(0xFFFFFFFF, fs->freemap, len) != header.crc) return -1;
+	return header.free;
+}
+
+/*
+ * Called before every prog, a saved map no longer matches once littlefs
+ * writes anything
+ */
+static int littlefs_freemap_invalidate(W25QXX_LittleFSTypeDef *fs) {
+	if (!fs->freemap_saved) return 0;
+	fs->freemap_saved = 0;
+	uint32_t invalid = 0;
+	return littlefs_dev_write(fs, fs->config.block_count, offsetof(littlefs_freemap_header_t, invalid), &invalid, sizeof(invalid));
+}
+#endif
+
+static int littlefs_pool_find(W25QXX_LittleFSTypeDef *fs, lfs_block_t block) {
+	for (uint32_t i = 0; i < fs->pool_count; ++i) {
+		if (fs->pool[i] == block) return i;
+	}
+	return -1;
+}
+
+/*
+ * Remove a block from the pool, returns 1 if it was there
+ */
+static int littlefs_pool_take(W25QXX_LittleFSTypeDef *fs, lfs_block_t block) {
+	int i = littlefs_pool_find(fs, block);
+	if (i < 0) return 0;
+	fs->pool[i] = fs->pool[--fs->pool_count];
+	return 1;
+}
+
+/*
+ * Drop read-ahead data that a prog or erase is about to change, a window
+ * elsewhere in the block stays valid
+ */
+static void littlefs_ra_invalidate(W25QXX_LittleFSTypeDef *fs, lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+#if W25QXX_LITTLEFS_READ_AHEAD_SIZE > 0
+	if (fs->ra.block == block && off < fs->ra.off + fs->ra.len && off + size > fs->ra.off) fs->ra.len = 0;
+#else
+	(void) fs;
+	(void) block;
+	(void) off;
+	(void) size;
+#endif
+}
+
+static int littlefs_read_ahead(W25QXX_LittleFSTypeDef *fs, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+#if W25QXX_LITTLEFS_READ_AHEAD_SIZE > 0
+	if (fs->ra.len && fs->ra.block == block
+			&& off >= fs->ra.off && off + size <= fs->ra.off + fs->ra.len) {
+		memcpy(buffer, fs->ra.data + (off - fs->ra.off), size);
+		fs->ra.next_block = block;
+		fs->ra.next_off = off + size;
+		return 0;
+	}
+
+	// Only file data is read front to back, metadata fetches and the reads
+	// validating progs would throw most of a window away
+	if (lfs_fs_data_read(&fs->lfs)) {
+		int sequential = fs->ra.tracking && fs->ra.next_block == block && fs->ra.next_off == off;
+		fs->ra.tracking = 1;
+		fs->ra.next_block = block;
+		fs->ra.next_off = off + size;
+
+		lfs_size_t window = fs->config.block_size - off < sizeof(fs->ra.data) ? fs->config.block_size - off : sizeof(fs->ra.data);
+		if (sequential && size < window) {
+			fs->ra.len = 0;
+			if (littlefs_dev_read(fs, block, off, fs->ra.data, window)) return -1;
+			fs->ra.block = block;
+			fs->ra.off = off;
+			fs->ra.len = window;
+			memcpy(buffer, fs->ra.data, size);
+			return 0;
+		}
+	}
+#endif
 
-int w25qxx_littlefs_init(W25QXX_HandleTypeDef *w25qxx_init) {
-	LFS_DBG("LittleFS Init");
-	w25qxx_handle = w25qxx_init;
+	return littlefs_dev_read(fs, block, off, buffer, size);
+}
+
+#ifdef W25QXX_LITTLEFS_BLANK_CHECK
+/*
+ * Return 1 if the whole block reads back as 0xFF.  Stops at the first
+ * programmed byte, so a block in use costs only a short read.
+ */
+static int littlefs_block_blank(W25QXX_LittleFSTypeDef *fs, lfs_block_t block) {
+	uint8_t buf[W25QXX_LITTLEFS_BLANK_CHECK_SIZE];
+
+	for (lfs_off_t off = 0; off < fs->config.block_size; off += sizeof(buf)) {
+		lfs_size_t len = fs->config.block_size - off < sizeof(buf) ? fs->config.block_size - off : sizeof(buf);
+		if (littlefs_dev_read(fs, block, off, buf, len) != 0) return 0;
+		for (lfs_size_t i = 0; i < len; ++i) {
+			if (buf[i] != 0xFF) return 0;
+		}
+	}
+
+	return 1;
+}
+#endif
 
-	littlefs_config.block_size = w25qxx_handle->sector_size;
-	littlefs_config.block_count = w25qxx_handle->sectors_in_block * w25qxx_handle->block_count;
+/*
+ * Return 0 if the block is known to be erased already
+ */
+static int littlefs_erase_needed(W25QXX_LittleFSTypeDef *fs, lfs_block_t block) {
+	if (littlefs_pool_take(fs, block)) {
+		++fs->erases_skipped;
+		return 0;
+	}
+#ifdef W25QXX_LITTLEFS_BLANK_CHECK
+	if (littlefs_block_blank(fs, block)) {
+		++fs->erases_skipped;
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+/*
+ * Carve the read cache, prog cache and lookahead buffer out of fs->ram.  The
+ * lookahead goes first: once it has covered the whole device an allocation
+ * never needs another traversal of the filesystem to refill it.  The rest
+ * doubles the caches, which cuts the SPI transactions per metadata fetch.
+ */
+static int littlefs_tune(W25QXX_LittleFSTypeDef *fs) {
+	struct lfs_config *cfg = &fs->config;
+	lfs_size_t cache_size = cfg->cache_size ? cfg->cache_size : lfs_max(cfg->read_size, cfg->prog_size);
+	lfs_size_t lookahead_size = cfg->lookahead_size;
 
-	int err = lfs_mount(&littlefs, &littlefs_config);
+	if (fs->ram_size < 2 * cache_size + 8) return LFS_ERR_NOMEM;
+	if (!lookahead_size) {
+		lookahead_size = ((cfg->block_count + 63) / 64) * 8;
+		lookahead_size = lfs_min(lookahead_size, (fs->ram_size - 2 * cache_size) & ~7);
+	}
+	if (!cfg->cache_size) {
+		while (cache_size * 2 <= W25QXX_LITTLEFS_CACHE_MAX && cfg->block_size % (cache_size * 2) == 0
+				&& 4 * cache_size + lookahead_size <= fs->ram_size)
+			cache_size *= 2;
+	}
+	if (2 * cache_size + lookahead_size > fs->ram_size) return LFS_ERR_NOMEM;
 
-    // reformat if we can't mount the filesystem
-    // this should only happen on the first boot
-    if (err) {
-        lfs_format(&littlefs, &littlefs_config);
-        lfs_mount(&littlefs, &littlefs_config);
+	cfg->cache_size = cache_size;
+	cfg->lookahead_size = lookahead_size;
+	// littlefs inlines files up to cache_size (capped at metadata_max / 8), which
+	// with bigger caches fills directories with file data and every lookup reads
+	// through it
+	if (!cfg->inline_max) cfg->inline_max = lfs_min(cache_size, (cfg->metadata_max ? cfg->metadata_max : cfg->block_size) / 16);
+	cfg->lookahead_buffer = fs->ram;
+	cfg->read_buffer = fs->ram + lookahead_size;
+	cfg->prog_buffer = fs->ram + lookahead_size + cache_size;
+	LFS_DBG("LittleFS tuned cache = %" PRIu32 " lookahead = %" PRIu32, cache_size, lookahead_size);
+	return 0;
+}
+
+/*
+ * Fill in the block device part of the config and mount, formatting first if
+ * there is no filesystem yet
+ */
+static int w25qxx_littlefs_mount(W25QXX_LittleFSTypeDef *fs, uint32_t device_size, uint32_t sector_size, uint32_t offset, uint32_t block_count) {
+	// Blocks may span several sectors, erased with the 32/64 KB block erase commands
+	uint32_t block_size = fs->config.block_size ? fs->config.block_size : sector_size;
+
+	if (!sector_size || block_size % sector_size || offset % sector_size || offset >= device_size) return LFS_ERR_INVAL;
+	if (!block_count) block_count = (device_size - offset) / block_size;
+	if (!block_count || block_count > (device_size - offset) / block_size) return LFS_ERR_INVAL;
+
+	fs->offset = offset;
+	fs->erases_skipped = 0;
+	fs->pool_count = 0;
+#if W25QXX_LITTLEFS_READ_AHEAD_SIZE > 0
+	fs->ra.len = 0;
+	fs->ra.tracking = 0;
+#endif
+#ifdef W25QXX_LITTLEFS_STATS
+	w25qxx_littlefs_reset_stats(fs);
+#endif
+
+	struct lfs_config *cfg = &fs->config;
+	cfg->context = fs;
+	cfg->read = littlefs_read;
+	cfg->prog = littlefs_prog;
+	cfg->erase = littlefs_erase;
+	cfg->sync = littlefs_sync;
+	cfg->block_size = block_size;
+	cfg->block_count = block_count;
+	// Keep metadata pairs from growing to a whole large block before compacting
+	if (!cfg->metadata_max && block_size > W25QXX_LITTLEFS_METADATA_MAX) cfg->metadata_max = W25QXX_LITTLEFS_METADATA_MAX;
+	if (!cfg->read_size) cfg->read_size = littlefs_defaults.read_size;
+	if (!cfg->prog_size) cfg->prog_size = littlefs_defaults.prog_size;
+	if (fs->ram) {
+		int err = littlefs_tune(fs);
+		if (err) return err;
+	}
+	if (!cfg->cache_size) cfg->cache_size = littlefs_defaults.cache_size;
+	if (!cfg->lookahead_size) cfg->lookahead_size = littlefs_defaults.lookahead_size;
+	if (!cfg->block_cycles) cfg->block_cycles = littlefs_defaults.block_cycles;
+#ifdef W25QXX_LITTLEFS_FREEMAP
+	// Last block holds the saved map, a format invalidates it like any prog
+	if (block_count < 2 || block_count - 1 > W25QXX_LITTLEFS_FREEMAP_BLOCKS) return LFS_ERR_INVAL;
+	cfg->block_count = block_count - 1;
+	cfg->freemap_buffer = fs->freemap;
+	int32_t freemap_free = littlefs_freemap_check(fs);
+	fs->freemap_saved = freemap_free >= 0;
+#endif
+
+	int err = lfs_mount(&fs->lfs, cfg);
+
+	// A volume formatted with W25QXX_LITTLEFS_FREEMAP the other way round has
+	// one block more or less, mount it as it is instead of reformatting
+#ifdef W25QXX_LITTLEFS_FREEMAP
+	if (err == LFS_ERR_INVAL) {
+		// No block reserved, run without the map
+		cfg->block_count = block_count;
+		cfg->freemap_buffer = NULL;
+		fs->freemap_saved = 0;
+		err = lfs_mount(&fs->lfs, cfg);
+	}
+#else
+	if (err == LFS_ERR_INVAL && block_count > 1) {
+		cfg->block_count = block_count - 1;
+		err = lfs_mount(&fs->lfs, cfg);
+		// Progs here are not tracked by the saved map, drop it
+		littlefs_freemap_header_t header;
+		if (!err && !littlefs_dev_read(fs, cfg->block_count, 0, &header, sizeof(header))
+				&& header.magic == LITTLEFS_FREEMAP_MAGIC && header.invalid) {
+			uint32_t invalid = 0;
+			if (littlefs_dev_write(fs, cfg->block_count, offsetof(littlefs_freemap_header_t, invalid), &invalid, sizeof(invalid))) {
+				lfs_unmount(&fs->lfs);
+				err = LFS_ERR_IO;
+			}
+		}
+	}
+#endif
+
+    // reformat if there is no filesystem, this should only happen on the
+    // first boot.  A mismatched geometry is reported instead.
+    if (err == LFS_ERR_CORRUPT) {
+        lfs_format(&fs->lfs, cfg);
+        err = lfs_mount(&fs->lfs, cfg);
     }
 
-    return 0;
+#ifdef W25QXX_LITTLEFS_FREEMAP
+	if (!err && fs->freemap_saved) {
+		fs->lfs.freemap.valid = true;
+		fs->lfs.freemap.free = freemap_free;
+	}
+#endif
+    return err;
 
 }
 
-int littlefs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
-	LFS_DBG("LittleFS Read b = 0x%04lx o = 0x%04lx s = 0x%04lx", block, off, size);
-	if (w25qxx_read(w25qxx_handle, block * w25qxx_handle->sector_size + off, buffer, size) != W25QXX_Ok) return -1;
+/*
+ * Mount a filesystem on block_count blocks from offset on a chip, 0 for the
+ * rest of the chip.  Blocks are one sector unless config.block_size was set
+ * to a multiple of it, e.g. 65536 to use 64 KB block erases.
+ */
+int w25qxx_littlefs_init(W25QXX_LittleFSTypeDef *fs, W25QXX_HandleTypeDef *w25qxx, uint32_t offset, uint32_t block_count) {
+	LFS_DBG("LittleFS Init o = 0x%08" PRIx32 " c = %" PRIu32, offset, block_count);
+	fs->w25qxx = w25qxx;
+	fs->array = NULL;
+
+	return w25qxx_littlefs_mount(fs, w25qxx->block_count * w25qxx->block_size, w25qxx->sector_size, offset, block_count);
+}
+
+int w25qxx_littlefs_array_init(W25QXX_LittleFSTypeDef *fs, W25QXX_ArrayTypeDef *array, uint32_t offset, uint32_t block_count) {
+	LFS_DBG("LittleFS Array Init o = 0x%08" PRIx32 " c = %" PRIu32, offset, block_count);
+	fs->w25qxx = NULL;
+	fs->array = array;
+
+	return w25qxx_littlefs_mount(fs, array->size, array->sector_size, offset, block_count);
+}
+
+/*
+ * Mount a filesystem on a W25QXX_PARTITION_LITTLEFS partition
+ */
+int w25qxx_littlefs_partition_init(W25QXX_LittleFSTypeDef *fs, W25QXX_PartitionTypeDef *partition) {
+	if (!partition || partition->type != W25QXX_PARTITION_LITTLEFS) return LFS_ERR_INVAL;
+	uint32_t block_size = fs->config.block_size ? fs->config.block_size : partition->w25qxx->sector_size;
+	if (partition->size < block_size) return LFS_ERR_INVAL;
+	return w25qxx_littlefs_init(fs, partition->w25qxx, partition->offset, partition->size / block_size);
+}
+
+/*
+ * Erase one free block ahead of time so that littlefs_erase can skip it later.
+ * Meant to be called repeatedly from the idle loop while the filesystem is
+ * mounted: at most one erase is issued per call and the driver leaves it
+ * running in the background.  Candidates are the free blocks littlefs will
+ * hand out next, taken from its lookahead window (empty after a mount until
+ * the first allocation or lfs_fs_gc fills it).  The pool only lives in RAM,
+ * so after a reset every block is erased again before use, and a pre-erase
+ * cut short by power loss only ever hits a block that holds no data.
+ *
+ * Returns 1 if an erase was issued, 0 if there was nothing to do and a
+ * negative value on error.
+ */
+int w25qxx_littlefs_pre_erase(W25QXX_LittleFSTypeDef *fs) {
+	if (fs->pool_count >= W25QXX_LITTLEFS_POOL_SIZE) return 0;
+
+	lfs_block_t block;
+	for (lfs_size_t n = 0; lfs_fs_next_free(&fs->lfs, n, &block) == 0; ++n) {
+		if (littlefs_pool_find(fs, block) >= 0) continue;
+
+		LFS_DBG("LittleFS Pre-erase b = 0x%04" PRIx32, block);
+		int err = littlefs_erase(&fs->config, block);
+		if (err) return err;
+
+		fs->pool[fs->pool_count++] = block;
+		return 1;
+	}
+
 	return 0;
 }
 
-int littlefs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
-	LFS_DBG("LittleFS Prog b = 0x%04lx o = 0x%04lx s = 0x%04lx", block, off, size);
-	if (w25qxx_write(w25qxx_handle, block * w25qxx_handle->sector_size + off, (void *)buffer, size) != W25QXX_Ok) return -1;
+#ifdef W25QXX_LITTLEFS_FREEMAP
+/*
+ * Save the map of in-use blocks so the next mount doesn't have to traverse the
+ * filesystem, e.g. before powering down.  Call it between operations, with no
+ * file open for writing.
+ */
+int w25qxx_littlefs_save_freemap(W25QXX_LittleFSTypeDef *fs) {
+	if (fs->freemap_saved) return 0;
+
+	// littlefs marks its latest allocations, or builds the map if it has none
+	lfs_ssize_t free = lfs_fs_freemap(&fs->lfs);
+	if (free < 0) return free;
+
+	lfs_size_t len = (fs->config.block_count + 7) / 8;
+
+	littlefs_freemap_header_t header = {
+		.magic = 0xFFFFFFFF,
+		.invalid = 0xFFFFFFFF,
+		.version = LITTLEFS_FREEMAP_VERSION,
+		.block_count = fs->config.block_count,
+		.free = free,
+		.crc = lfs_crc(0xFFFFFFFF, fs->freemap, len),
+	};
+	uint32_t magic = LITTLEFS_FREEMAP_MAGIC;
+	lfs_block_t block = fs->config.block_count;
+	if (littlefs_dev_erase(fs, block)
+			|| littlefs_dev_write(fs, block, 0, &header, sizeof(header))
+			|| littlefs_dev_write(fs, block, sizeof(header), fs->freemap, len)
+			|| littlefs_dev_write(fs, block, offsetof(littlefs_freemap_header_t, magic), &magic, sizeof(magic))) return LFS_ERR_IO;
+
+	fs->freemap_saved = 1;
 	return 0;
 }
+#endif
+
+#ifdef W25QXX_LITTLEFS_STATS
+const W25QXX_littlefs_stats_t *w25qxx_littlefs_get_stats(W25QXX_LittleFSTypeDef *fs) {
+	return &fs->stats;
+}
+
+/*
+ * Clear all counters, block_erases is kept but zeroed
+ */
+void w25qxx_littlefs_reset_stats(W25QXX_LittleFSTypeDef *fs) {
+	memset(&fs->stats.read, 0, sizeof(fs->stats.read));
+	memset(&fs->stats.prog, 0, sizeof(fs->stats.prog));
+	memset(&fs->stats.erase, 0, sizeof(fs->stats.erase));
+	memset(&fs->stats.sync, 0, sizeof(fs->stats.sync));
+	if (fs->stats.block_erases) memset(fs->stats.block_erases, 0, fs->stats.block_erases_len * sizeof(uint16_t));
+}
+#endif
+
+int littlefs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+	LFS_DBG("LittleFS Read b = 0x%04" PRIx32 " o = 0x%04" PRIx32 " s = 0x%04" PRIx32, block, off, size);
+	W25QXX_LittleFSTypeDef *fs = c->context;
+	LFS_STAT_BEGIN();
+	int err = littlefs_read_ahead(fs, block, off, buffer, size);
+	LFS_STAT_END(fs, read, size);
+	return err;
+}
+
+int littlefs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+	LFS_DBG("LittleFS Prog b = 0x%04" PRIx32 " o = 0x%04" PRIx32 " s = 0x%04" PRIx32, block, off, size);
+	W25QXX_LittleFSTypeDef *fs = c->context;
+	LFS_STAT_BEGIN();
+#ifdef W25QXX_LITTLEFS_FREEMAP
+	if (littlefs_freemap_invalidate(fs)) return LFS_ERR_IO;
+#endif
+	littlefs_pool_take(fs, block);
+	littlefs_ra_invalidate(fs, block, off, size);
+	int err = littlefs_dev_write(fs, block, off, buffer, size);
+	LFS_STAT_END(fs, prog, size);
+	return err;
+}
 
 int littlefs_erase(const struct lfs_config *c, lfs_block_t block) {
-	LFS_DBG("LittleFS Erase b = 0x%04lx", block);
-	if (w25qxx_erase(w25qxx_handle, block * w25qxx_handle->sector_size, w25qxx_handle->sector_size) != W25QXX_Ok) return -1;
-	return 0;
+	LFS_DBG("LittleFS Erase b = 0x%04" PRIx32, block);
+	W25QXX_LittleFSTypeDef *fs = c->context;
+	LFS_STAT_BEGIN();
+	int err = 0;
+	littlefs_ra_invalidate(fs, block, 0, fs->config.block_size);
+	if (littlefs_erase_needed(fs, block)) err = littlefs_dev_erase(fs, block);
+	LFS_STAT_END(fs, erase, fs->config.block_size);
+	return err;
 }
 
 int littlefs_sync(const struct lfs_config *c) {
 	LFS_DBG("LittleFS Sync");
+	W25QXX_LittleFSTypeDef *fs = c->context;
+	(void) fs;
+	LFS_STAT_BEGIN();
+	// Progs go straight to the chip, there is nothing to write out
+	LFS_STAT_END(fs, sync, 0);
 	return 0;
 }
 
@@ -8,17 +8,169 @@
 #ifndef W25QXX_LITTLEFS_H_
 #define W25QXX_LITTLEFS_H_
 
+#include "lfs.h"
 #include "w25qxx.h"
+#include "w25qxx_array.h"
+#include "w25qxx_partition.h"
 
 #ifdef DEBUGxxx
+#include <inttypes.h>
 #define LFS_DBG(...) printf(__VA_ARGS__);\
                      printf("\n");
 #else
 #define LFS_DBG(...) ;
 #endif
 
-extern lfs_t littlefs;
+/*
+ * Define W25QXX_LITTLEFS_BLANK_CHECK to read a block back before erasing it and
+ * skip the erase when it is already all 0xFF (typical after format or on a new
+ * chip).  Off by default: a block whose erase was cut short by power loss can
+ * read as 0xFF while still being weakly erased.  The block is read in
+ * W25QXX_LITTLEFS_BLANK_CHECK_SIZE byte chunks into a buffer on the stack.
+ */
+#ifndef W25QXX_LITTLEFS_BLANK_CHECK_SIZE
+#define W25QXX_LITTLEFS_BLANK_CHECK_SIZE 256
+#endif
+
+/*
+ * Number of blocks w25qxx_littlefs_pre_erase keeps erased ahead of use, per
+ * filesystem
+ */
+#ifndef W25QXX_LITTLEFS_POOL_SIZE
+#define W25QXX_LITTLEFS_POOL_SIZE 8
+#endif
+
+/*
+ * When littlefs reads file data on from where its previous read in the same
+ * block ended, up to this many bytes (bounded by the end of the block) are
+ * fetched in one go and later reads are answered from RAM.  Metadata reads
+ * never start a window.  Off (0) by default; define it to e.g. 1024 in the
+ * compiler flags to enable it.
+ */
+#ifndef W25QXX_LITTLEFS_READ_AHEAD_SIZE
+#define W25QXX_LITTLEFS_READ_AHEAD_SIZE 0
+#endif
+
+/*
+ * metadata_max used when config.block_size is set above this (32 or 64 KB
+ * blocks), so metadata pairs are compacted at this size instead of filling
+ * the whole block
+ */
+#ifndef W25QXX_LITTLEFS_METADATA_MAX
+#define W25QXX_LITTLEFS_METADATA_MAX 4096
+#endif
+
+/*
+ * Largest cache_size picked when the caches are sized from a RAM budget.  Each
+ * open file still mallocs a cache of that size.
+ */
+#ifndef W25QXX_LITTLEFS_CACHE_MAX
+#define W25QXX_LITTLEFS_CACHE_MAX 1024
+#endif
+
+/*
+ * Define W25QXX_LITTLEFS_FREEMAP to give littlefs a map of in-use blocks
+ * (config.freemap_buffer), so the lookahead is refilled from RAM instead of
+ * traversing the whole filesystem.  The last block of the volume is reserved
+ * for a copy saved by w25qxx_littlefs_save_freemap(), which is loaded at mount
+ * instead of traversing and invalidated before the first prog after it was
+ * saved.  Volumes are limited to W25QXX_LITTLEFS_FREEMAP_BLOCKS blocks.
+ * A volume formatted with it off still mounts, with all its blocks and
+ * without the map.  One formatted with it on mounts with it off too, leaving
+ * the last block unused and marking the saved map invalid.
+ */
+#if defined(W25QXX_LITTLEFS_FREEMAP) && !defined(W25QXX_LITTLEFS_FREEMAP_BLOCKS)
+#define W25QXX_LITTLEFS_FREEMAP_BLOCKS 4096
+#endif
+
+/*
+ * Define W25QXX_LITTLEFS_STATS to count the block device operations of each
+ * filesystem and time them with W25QXX_LITTLEFS_STATS_TIME().  That defaults
+ * to HAL_GetTick(); map it to a finer counter (e.g. DWT->CYCCNT) to get useful
+ * latencies for reads and progs.  Latency bucket n counts operations taking
+ * less than 2^n ticks (bucket 0: no measurable time).
+ */
+#ifdef W25QXX_LITTLEFS_STATS
 
-int w25qxx_littlefs_init(W25QXX_HandleTypeDef *w25qxx_init);
+#ifndef W25QXX_LITTLEFS_STATS_TIME
+#define W25QXX_LITTLEFS_STATS_TIME() HAL_GetTick()
+#endif
+
+#define W25QXX_LITTLEFS_STATS_BUCKETS 16
+
+typedef struct {
+    uint32_t count;
+    uint64_t bytes;
+    uint32_t time_min;
+    uint32_t time_max;
+    uint64_t time_total;               // time_total / count is the average
+    uint32_t histogram[W25QXX_LITTLEFS_STATS_BUCKETS];
+} W25QXX_littlefs_op_stats_t;
+
+typedef struct {
+    W25QXX_littlefs_op_stats_t read;
+    W25QXX_littlefs_op_stats_t prog;
+    W25QXX_littlefs_op_stats_t erase;  // Includes skipped erases
+    W25QXX_littlefs_op_stats_t sync;
+    uint16_t *block_erases;            // Optional, device erases per block, set before init
+    uint32_t block_erases_len;         // Entries in block_erases
+} W25QXX_littlefs_stats_t;
+
+#endif
+
+/*
+ * One littlefs filesystem on a W25Qxx chip or chip array.  The block device
+ * callbacks find it through config.context, so several of these can be mounted
+ * at the same time, on different chips or side by side on one chip.  Start
+ * from a zeroed struct; block_size, read_size, prog_size, cache_size,
+ * lookahead_size, block_cycles and metadata_max left at 0 in config get
+ * defaults, anything set before init is kept.
+ *
+ * Point ram at a static buffer of ram_size bytes to have the read and prog
+ * caches and the lookahead buffer placed there instead of on the heap, with
+ * cache_size and lookahead_size (if left at 0) sized to fit it.
+ */
+typedef struct {
+    lfs_t lfs;
+    struct lfs_config config;
+    W25QXX_HandleTypeDef *w25qxx;     // Either a single chip ...
+    W25QXX_ArrayTypeDef *array;       // ... or an array of chips
+    uint32_t offset;                  // Device address of block 0
+    uint8_t *ram;                     // Optional static buffer for caches and lookahead
+    uint32_t ram_size;
+    uint32_t erases_skipped;          // Blank or pre-erased blocks
+    lfs_block_t pool[W25QXX_LITTLEFS_POOL_SIZE]; // Erased ahead, not programmed since
+    uint32_t pool_count;
+#ifdef W25QXX_LITTLEFS_STATS
+    W25QXX_littlefs_stats_t stats;
+#endif
+#ifdef W25QXX_LITTLEFS_FREEMAP
+    uint8_t freemap[(W25QXX_LITTLEFS_FREEMAP_BLOCKS + 7) / 8];
+    int freemap_saved;                // The copy on flash is valid
+#endif
+#if W25QXX_LITTLEFS_READ_AHEAD_SIZE > 0
+    struct {
+        lfs_block_t block;
+        lfs_off_t off;
+        lfs_size_t len;
+        int tracking;                 // next_block/next_off are valid
+        lfs_block_t next_block;
+        lfs_off_t next_off;
+        uint8_t data[W25QXX_LITTLEFS_READ_AHEAD_SIZE];
+    } ra;
+#endif
+} W25QXX_LittleFSTypeDef;
+
+int w25qxx_littlefs_init(W25QXX_LittleFSTypeDef *fs, W25QXX_HandleTypeDef *w25qxx, uint32_t offset, uint32_t block_count);
+int w25qxx_littlefs_array_init(W25QXX_LittleFSTypeDef *fs, W25QXX_ArrayTypeDef *array, uint32_t offset, uint32_t block_count);
+int w25qxx_littlefs_partition_init(W25QXX_LittleFSTypeDef *fs, W25QXX_PartitionTypeDef *partition);
+int w25qxx_littlefs_pre_erase(W25QXX_LittleFSTypeDef *fs);
+#ifdef W25QXX_LITTLEFS_FREEMAP
+int w25qxx_littlefs_save_freemap(W25QXX_LittleFSTypeDef *fs);
+#endif
+#ifdef W25QXX_LITTLEFS_STATS
+const W25QXX_littlefs_stats_t *w25qxx_littlefs_get_stats(W25QXX_LittleFSTypeDef *fs);
+void w25qxx_littlefs_reset_stats(W25QXX_LittleFSTypeDef *fs);
+#endif
 
 #endif /* W25QXX_LITTLEFS_H_ */
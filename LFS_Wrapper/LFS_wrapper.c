@@ -6,29 +6,34 @@
  */
 
 #include "LFS_wrapper.h"
+#ifdef W25QXX_LITTLEFS_STATS
+#include "main.h"
+#include "w25qxx_littlefs.h"
+#endif
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
 // Save data into a file in LittleFS
-bool saveFileIntoFlash(const char *fileName, const void *data, size_t dataSize,
-		size_t *ret_BytesWritten) {
+bool saveFileIntoFlash(lfs_t *lfs, const char *fileName, const void *data,
+		size_t dataSize, size_t *ret_BytesWritten) {
 	lfs_file_t file;
-	int err = lfs_file_open(&littlefs, &file, fileName,
+	int err = lfs_file_open(lfs, &file, fileName,
 			LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
 	if (err < 0) {
 		printf("Failed to open file for writing: %d\r\n", err);
 		return false;
 	}
 
-	lfs_ssize_t bytes_written = lfs_file_write(&littlefs, &file, data,
+	lfs_ssize_t bytes_written = lfs_file_write(lfs, &file, data,
 			dataSize);
 	if (bytes_written < 0) {
 		printf("Failed to write to file: %d\r\n", (int) bytes_written);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	}
 
-	lfs_file_close(&littlefs, &file);
+	lfs_file_close(lfs, &file);
 	if (ret_BytesWritten) {
 		*ret_BytesWritten = (size_t) bytes_written;
 	}
@@ -37,22 +42,22 @@ bool saveFileIntoFlash(const char *fileName, const void *data, size_t dataSize,
 }
 
 // Get the size of a file in LittleFS
-bool getFileSize(const char *fileName, size_t *ret_FileSize) {
+bool getFileSize(lfs_t *lfs, const char *fileName, size_t *ret_FileSize) {
 	lfs_file_t file;
-	int err = lfs_file_open(&littlefs, &file, fileName, LFS_O_RDONLY);
+	int err = lfs_file_open(lfs, &file, fileName, LFS_O_RDONLY);
 	if (err < 0) {
 		printf("Failed to open file for reading: %d\r\n", err);
 		return false;
 	}
 
-	lfs_soff_t file_size = lfs_file_size(&littlefs, &file);
+	lfs_soff_t file_size = lfs_file_size(lfs, &file);
 	if (file_size < 0) {
 		printf("Failed to get file size: %d\r\n", (int) file_size);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	}
 
-	lfs_file_close(&littlefs, &file);
+	lfs_file_close(lfs, &file);
 	if (ret_FileSize) {
 		*ret_FileSize = (size_t) file_size;
 	}
@@ -61,24 +66,24 @@ bool getFileSize(const char *fileName, size_t *ret_FileSize) {
 }
 
 // Read data from a file in LittleFS
-bool readFilefromFlash(const char *fileName, size_t bytesToRead,
+bool readFilefromFlash(lfs_t *lfs, const char *fileName, size_t bytesToRead,
 		char *ret_DataBuffer, size_t *ret_DataSize) {
 	lfs_file_t file;
-	int err = lfs_file_open(&littlefs, &file, fileName, LFS_O_RDONLY);
+	int err = lfs_file_open(lfs, &file, fileName, LFS_O_RDONLY);
 	if (err < 0) {
 		printf("Failed to open file for reading: %d\r\n", err);
 		return false;
 	}
 
-	lfs_ssize_t bytes_read = lfs_file_read(&littlefs, &file, ret_DataBuffer,
+	lfs_ssize_t bytes_read = lfs_file_read(lfs, &file, ret_DataBuffer,
 			bytesToRead);
 	if (bytes_read < 0) {
 		printf("Failed to read from file: %d\r\n", (int) bytes_read);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	}
 
-	lfs_file_close(&littlefs, &file);
+	lfs_file_close(lfs, &file);
 	if (ret_DataSize) {
 		*ret_DataSize = (size_t) bytes_read;
 	}
@@ -87,25 +92,26 @@ bool readFilefromFlash(const char *fileName, size_t bytesToRead,
 }
 
 // Append data to the end of a file in LittleFS
-bool appendDataAtTheEndOfFile(const char *fileName, const char *dataBuffer,
-		size_t fileSizeToWrite, size_t *ret_bytesWritten) {
+bool appendDataAtTheEndOfFile(lfs_t *lfs, const char *fileName,
+		const char *dataBuffer, size_t fileSizeToWrite,
+		size_t *ret_bytesWritten) {
 	lfs_file_t file;
-	int err = lfs_file_open(&littlefs, &file, fileName,
+	int err = lfs_file_open(lfs, &file, fileName,
 			LFS_O_WRONLY | LFS_O_APPEND | LFS_O_CREAT);
 	if (err < 0) {
 		printf("Failed to open file for appending: %d\n", err);
 		return false;
 	}
 
-	lfs_ssize_t bytesWritten = lfs_file_write(&littlefs, &file, dataBuffer,
+	lfs_ssize_t bytesWritten = lfs_file_write(lfs, &file, dataBuffer,
 			fileSizeToWrite);
 	if (bytesWritten < 0) {
 		printf("Failed to append to file: %s\r\n", fileName);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	}
 
-	lfs_file_close(&littlefs, &file);
+	lfs_file_close(lfs, &file);
 	if (ret_bytesWritten) {
 		*ret_bytesWritten = fileSizeToWrite;
 	}
@@ -113,11 +119,11 @@ bool appendDataAtTheEndOfFile(const char *fileName, const char *dataBuffer,
 }
 
 // Append data to the end of a file with new line in LittleFS
-bool appendDataAtTheEndOfFileWithNewLine(const char *fileName,
+bool appendDataAtTheEndOfFileWithNewLine(lfs_t *lfs, const char *fileName,
 		const char *dataBuffer, size_t fileSizeToWrite,
 		size_t *ret_bytesWritten) {
 	lfs_file_t file;
-	int err = lfs_file_open(&littlefs, &file, fileName,
+	int err = lfs_file_open(lfs, &file, fileName,
 			LFS_O_WRONLY | LFS_O_APPEND | LFS_O_CREAT);
 	if (err < 0) {
 		printf("Failed to open file for appending: %d\n", err);
@@ -128,23 +134,23 @@ bool appendDataAtTheEndOfFileWithNewLine(const char *fileName,
 	char *bufferToWrite = calloc((fileSizeToWrite + 1), sizeof(char));
 	if (bufferToWrite == NULL) {
 		printf(
-				"[ ERROR ] allocating memory of size %u for appending file %s \r\n",
+				"[ ERROR ] allocating memory of size %zu for appending file %s \r\n",
 				fileSizeToWrite + 1, fileName);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	}
 
 	/*get file size*/
 	size_t fileSize = 0;
-	bool status = getFileSize(fileName, &fileSize);
+	bool status = getFileSize(lfs, fileName, &fileSize);
 	if (!status) {
 		printf("[ ERROR ] reading file size of %s, While appending file\r\n",
 				fileName);
 		free(bufferToWrite);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		return false;
 	} else {
-		printf("[ INFO ] existing %s file, its size is %u \r\n", fileName,
+		printf("[ INFO ] existing %s file, its size is %zu \r\n", fileName,
 				fileSize);
 	}
 
@@ -152,27 +158,27 @@ bool appendDataAtTheEndOfFileWithNewLine(const char *fileName,
 	size_t newBufferSize = 0;
 	if (fileSize == 0) {
 		sprintf(bufferToWrite, "%s", dataBuffer);
-		printf("[ INFO ] Appending file of size %u without new line \r\n",
+		printf("[ INFO ] Appending file of size %zu without new line \r\n",
 				fileSizeToWrite);
 		newBufferSize = fileSizeToWrite;
 	} else {
 		sprintf(bufferToWrite, "\n%s", dataBuffer);
 		newBufferSize = fileSizeToWrite + 1; // added with \n
-		printf("[ INFO ] Appending file of size %u with new line \r\n",
+		printf("[ INFO ] Appending file of size %zu with new line \r\n",
 				fileSizeToWrite);
 	}
 
-	lfs_ssize_t bytesWritten = lfs_file_write(&littlefs, &file, bufferToWrite,
+	lfs_ssize_t bytesWritten = lfs_file_write(lfs, &file, bufferToWrite,
 			newBufferSize);
 	if (bytesWritten < 0) {
 		printf("Failed to append to file: %s\r\n", fileName);
-		lfs_file_close(&littlefs, &file);
+		lfs_file_close(lfs, &file);
 		free(bufferToWrite);
 		return false;
 	}
 
 	free(bufferToWrite);
-	lfs_file_close(&littlefs, &file);
+	lfs_file_close(lfs, &file);
 	if (ret_bytesWritten) {
 		*ret_bytesWritten = fileSizeToWrite;
 	}
@@ -181,8 +187,8 @@ bool appendDataAtTheEndOfFileWithNewLine(const char *fileName,
 }
 
 // Delete a file from LittleFS
-bool deleteFilefromFlash(const char *fileName) {
-	int err = lfs_remove(&littlefs, fileName);
+bool deleteFilefromFlash(lfs_t *lfs, const char *fileName) {
+	int err = lfs_remove(lfs, fileName);
 	if (err < 0) {
 		printf("Failed to delete file: %d\r\n", err);
 		return false;
@@ -193,14 +199,14 @@ bool deleteFilefromFlash(const char *fileName) {
 }
 
 // Function to read and print storage details
-void readAndPrintStorageDetails(void) {
+void readAndPrintStorageDetails(lfs_t *lfs) {
 	// Calculate used bytes in the filesystem
-	lfs_ssize_t used_blocks = lfs_fs_size(&littlefs);
-	uint64_t used_bytes = (uint64_t) used_blocks * littlefs_config.block_size;
+	lfs_ssize_t used_blocks = lfs_fs_size(lfs);
+	uint64_t used_bytes = (uint64_t) used_blocks * lfs->cfg->block_size;
 
 	// Calculate total bytes in the filesystem
-	uint64_t total_bytes = (uint64_t) littlefs_config.block_count
-			* littlefs_config.block_size;
+	uint64_t total_bytes = (uint64_t) lfs->cfg->block_count
+			* lfs->cfg->block_size;
 
 	// Convert bytes to megabytes (MB)
 	float used_mb = (float) used_bytes / (1024 * 1024);
@@ -217,13 +223,54 @@ void readAndPrintStorageDetails(void) {
 			" MB\r\n", free_mb);
 }
 
+#ifdef W25QXX_LITTLEFS_STATS
+static void printOpStats(const char *name, const W25QXX_littlefs_op_stats_t *op) {
+	printf("%-6s count %" PRIu32 " bytes %" PRIu64 " time min/avg/max %" PRIu32 "/%" PRIu64 "/%" PRIu32 "\r\n",
+			name, op->count, op->bytes, op->time_min,
+			op->count ? op->time_total / op->count : 0,
+			op->time_max);
+	printf("       histogram");
+	for (int i = 0; i < W25QXX_LITTLEFS_STATS_BUCKETS; i++) {
+		printf(" %" PRIu32, op->histogram[i]);
+	}
+	printf("\r\n");
+}
+
+// Function to print block device statistics of a filesystem mounted by the LLD
+void printBlockDeviceStats(lfs_t *lfs) {
+	const W25QXX_littlefs_stats_t *stats = w25qxx_littlefs_get_stats(
+			lfs->cfg->context);
+
+	printf("Block device statistics:\r\n");
+	printOpStats("read", &stats->read);
+	printOpStats("prog", &stats->prog);
+	printOpStats("erase", &stats->erase);
+	printOpStats("sync", &stats->sync);
+
+	if (stats->block_erases) {
+		uint32_t max = 0;
+		uint32_t max_block = 0;
+		uint64_t total = 0;
+		for (uint32_t i = 0; i < stats->block_erases_len; i++) {
+			total += stats->block_erases[i];
+			if (stats->block_erases[i] > max) {
+				max = stats->block_erases[i];
+				max_block = i;
+			}
+		}
+		printf("Block erases: total %" PRIu64 ", most %" PRIu32 " on block %" PRIu32 "\r\n",
+				total, max, max_block);
+	}
+}
+#endif
+
 // Function to list files with their sizes
-void listFiles(void) {
+void listFiles(lfs_t *lfs) {
 	lfs_dir_t dir;
 	struct lfs_info info;
 	printf("[ INFO ] Listing files present in the SPI FLASH \r\n");
 	// Open the root directory
-	int err = lfs_dir_open(&littlefs, &dir, "/");
+	int err = lfs_dir_open(lfs, &dir, "/");
 	if (err) {
 		printf("Failed to open directory: %d\r\n", err);
 		return;
@@ -232,7 +279,7 @@ void listFiles(void) {
 	printf("Files in LittleFS:\n");
 	// Iterate through the directory entries
 	while (true) {
-		int res = lfs_dir_read(&littlefs, &dir, &info);
+		int res = lfs_dir_read(lfs, &dir, &info);
 		if (res < 0) {
 			printf("Failed to read directory: %d\r\n", res);
 			break;
@@ -248,13 +295,13 @@ void listFiles(void) {
 	}
 
 	// Close the directory
-	lfs_dir_close(&littlefs, &dir);
+	lfs_dir_close(lfs, &dir);
 }
 
 // Function to format the flash
-void formatFlash(void) {
+void formatFlash(lfs_t *lfs) {
 	// Format the LittleFS filesystem
-	int err = lfs_format(&littlefs, &littlefs_config);
+	int err = lfs_format(lfs, lfs->cfg);
 	if (err) {
 		printf("Failed to format flash: %d\r\n", err);
 	} else {
@@ -263,7 +310,7 @@ void formatFlash(void) {
 }
 
 // Custom function to read a line from a LittleFS file
-char* lfs_gets(char *buf, int size, lfs_file_t *file) {
+char* lfs_gets(lfs_t *lfs, char *buf, int size, lfs_file_t *file) {
 	if (size < 1) {
 		return NULL; // Buffer size must be at least 1
 	}
@@ -271,7 +318,7 @@ char* lfs_gets(char *buf, int size, lfs_file_t *file) {
 	int i = 0;
 	while (i < size - 1) {
 		// Read one character at a time
-		int res = lfs_file_read(&littlefs, file, &buf[i], 1);
+		int res = lfs_file_read(lfs, file, &buf[i], 1);
 		if (res < 1) {
 			// End of file or read error
 			if (i == 0) {
@@ -295,11 +342,11 @@ char* lfs_gets(char *buf, int size, lfs_file_t *file) {
 }
 
 /*check if the file exists*/
-bool fileExists(const char *filePath) {
+bool fileExists(lfs_t *lfs, const char *filePath) {
 	struct lfs_info info; // Struct to hold file/directory metadata
 
 	// Use lfs_stat to check if the file exists
-	int result = lfs_stat(&littlefs, filePath, &info);
+	int result = lfs_stat(lfs, filePath, &info);
 
 	// If lfs_stat returns 0, the file exists
 	if (result == 0) {
@@ -12,29 +12,36 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-// Assuming `littlefs` is already initialized and mounted
-extern lfs_t littlefs;
-extern struct lfs_config littlefs_config;
+// Every function works on the mounted filesystem passed in as lfs
 
 // Function prototypes
 
 /*
  * Read and print storage details. it prints total size, free size and occupied size in MB
  * */
-void readAndPrintStorageDetails(void);
+void readAndPrintStorageDetails(lfs_t *lfs);
+
+#ifdef W25QXX_LITTLEFS_STATS
+/*
+ * Print the block device counters and latency histograms of a filesystem
+ * mounted with w25qxx_littlefs_init (needs W25QXX_LITTLEFS_STATS)
+ * */
+void printBlockDeviceStats(lfs_t *lfs);
+#endif
 
 /*
  * It lists and print all files availabel in the SPI Flash and its size
  * */
-void listFiles(void);
+void listFiles(lfs_t *lfs);
 
 /*
  * Format the flash
  * */
-void formatFlash(void);
+void formatFlash(lfs_t *lfs);
 
 /**
  * Save data into a file in LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file to save data into.
  * @param data: Pointer to the data to be written.
  * @param dataSize: Size of the data to be written.
@@ -43,30 +50,33 @@ void formatFlash(void);
  * @Note: If the file exists it will truncate the file to 0th position
  * 		  which means the existing file will get erased
  */
-bool saveFileIntoFlash(const char *fileName, const void *data, size_t dataSize,
-		size_t *ret_BytesWritten);
+bool saveFileIntoFlash(lfs_t *lfs, const char *fileName, const void *data,
+		size_t dataSize, size_t *ret_BytesWritten);
 
 /**
  * Get the size of a file in LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file.
  * @param ret_FileSize: Pointer to store the file size.
  * @return: true if successful, false otherwise.
  */
-bool getFileSize(const char *fileName, size_t *ret_FileSize);
+bool getFileSize(lfs_t *lfs, const char *fileName, size_t *ret_FileSize);
 
 /**
  * Read data from a file in LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file to read from.
  * @param bytesToRead: Number of bytes to read.
  * @param ret_DataBuffer: Buffer to store the read data.
  * @param ret_DataSize: Pointer to store the number of bytes read.
  * @return: true if successful, false otherwise.
  */
-bool readFilefromFlash(const char *fileName, size_t bytesToRead,
+bool readFilefromFlash(lfs_t *lfs, const char *fileName, size_t bytesToRead,
 		char *ret_DataBuffer, size_t *ret_DataSize);
 
 /**
  * Append data to the end of a file in LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file to append data to.
  * @param dataBuffer: Pointer to the data to append.
  * @param fileSizeToWrite: Size of the data to append.
@@ -75,11 +85,13 @@ bool readFilefromFlash(const char *fileName, size_t bytesToRead,
  * @Note It will just add the new data at the end of file without adding
  * 		 any marker between the existing an dnew data
  */
-bool appendDataAtTheEndOfFile(const char *fileName, const char *dataBuffer,
-		size_t fileSizeToWrite, size_t *ret_bytesWritten);
+bool appendDataAtTheEndOfFile(lfs_t *lfs, const char *fileName,
+		const char *dataBuffer, size_t fileSizeToWrite,
+		size_t *ret_bytesWritten);
 
 /**
  * Append data to the end of a file with new line in LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file to append data to.
  * @param dataBuffer: Pointer to the data to append.
  * @param fileSizeToWrite: Size of the data to append.
@@ -87,25 +99,26 @@ bool appendDataAtTheEndOfFile(const char *fileName, const char *dataBuffer,
  * @return: true if successful, false otherwise.
  * @Note If the file already exists, it puts a \n to put it in the new line
  */
-bool appendDataAtTheEndOfFileWithNewLine(const char *fileName,
+bool appendDataAtTheEndOfFileWithNewLine(lfs_t *lfs, const char *fileName,
 		const char *dataBuffer, size_t fileSizeToWrite,
 		size_t *ret_bytesWritten);
 
 /**
  * Delete a file from LittleFS.
+ * @param lfs: Mounted filesystem.
  * @param fileName: Name of the file to delete.
  * @return: true if successful, false otherwise.
  */
-bool deleteFilefromFlash(const char *fileName);
+bool deleteFilefromFlash(lfs_t *lfs, const char *fileName);
 
 /*
  * Read single line from the flash
  * */
-char* lfs_gets(char *buf, int size, lfs_file_t *file);
+char* lfs_gets(lfs_t *lfs, char *buf, int size, lfs_file_t *file);
 
 /*
  * check if the file exists or not
  * */
-bool fileExists(const char *filePath);
+bool fileExists(lfs_t *lfs, const char *filePath);
 
 #endif // LITTLEFS_WRAPPER_H
@@ -0,0 +1,576 @@
+/**
+ ******************************************************************************
+ * @file           : bench.c
+ * @brief          : Host benchmarks of littlefs on the W25Qxx LLD
+ ******************************************************************************
+ * Runs the workloads behind the numbers quoted for the LLD and littlefs
+ * changes on an emulated W25Q128 and prints simulated time, SPI bytes and
+ * HAL calls.  Build it once with the features off and once with them on
+ * (make bench) to compare.
+ */
+
+#include "test.h"
+#include "lfs.h"
+#include "w25qxx_littlefs.h"
+#include "LFS_wrapper.h"
+
+static W25QXX_HandleTypeDef w25qxx;
+static W25QXX_LittleFSTypeDef fs;
+#if LFS_NAME_INDEX
+// covers the 1000 file directory of bench_lookups
+static uint32_t names[16384 / 4];
+#endif
+static char data[16384];
+
+static struct {
+    uint64_t now;
+    uint64_t bytes;
+    uint64_t hal_calls;
+} mark;
+
+/*
+ * SPI bytes and HAL calls summed over all chips
+ */
+static void bench_counters(uint64_t *bytes, uint64_t *hal_calls) {
+    *bytes = 0;
+    *hal_calls = 0;
+    for (int i = 0; i < FLASH_EMU_CHIPS; ++i) {
+        *bytes += flash_emu_chips[i].bytes;
+        *hal_calls += flash_emu_chips[i].hal_calls + flash_emu_chips[i].dma_transfers;
+    }
+}
+
+static void bench_start(void) {
+    mark.now = flash_emu_now;
+    bench_counters(&mark.bytes, &mark.hal_calls);
+}
+
+/*
+ * Print the cost since bench_start, divided by count
+ */
+static void bench_report(const char *what, uint32_t count) {
+    uint64_t bytes, hal_calls;
+
+    bench_counters(&bytes, &hal_calls);
+    printf("  %-34s %10llu us %9llu SPI bytes %7llu HAL calls\n", what,
+            (unsigned long long) (flash_emu_now - mark.now) / count,
+            (unsigned long long) (bytes - mark.bytes) / count,
+            (unsigned long long) (hal_calls - mark.hal_calls) / count);
+}
+
+static void bench_mount_block(uint32_t blocks, lfs_size_t cache_size, lfs_size_t block_size) {
+    memset(&fs, 0, sizeof(fs));
+    fs.config.block_size = block_size;
+    if (cache_size) {
+        fs.config.read_size = cache_size;
+        fs.config.prog_size = cache_size;
+        fs.config.cache_size = cache_size;
+    }
+#if LFS_NAME_INDEX
+    fs.config.name_index_buffer = names;
+    fs.config.name_index_size = sizeof(names);
+#endif
+    CHECK(w25qxx_littlefs_init(&fs, &w25qxx, 0, blocks) == 0);
+}
+
+static void bench_mount(uint32_t blocks, lfs_size_t cache_size) {
+    bench_mount_block(blocks, cache_size, 0);
+}
+
+static void bench_remount(void) {
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    CHECK(lfs_mount(&fs.lfs, &fs.config) == 0);
+}
+
+static void bench_chip(void) {
+    flash_emu_call_us = 0;
+    test_chip(&w25qxx, 0, 16 << 20);
+}
+
+/*
+ * 20 files of 1000 to 2900 bytes with the default caches, with tiny caches
+ * and with 64 KB blocks, then a 1 MB file with 4 and 64 KB blocks
+ */
+static void bench_write(void) {
+    size_t n;
+    lfs_file_t f;
+    static const struct {
+        const char *name;
+        lfs_size_t cache_size;
+        lfs_size_t block_size;
+    } configs[] = {
+        { "default caches", 0, 0 },
+        { "cache_size 16", 16, 0 },
+        { "block_size 65536", 0, 65536 },
+    };
+
+    printf("write 20 files\n");
+    for (uint32_t c = 0; c < 3; ++c) {
+        bench_chip();
+        bench_mount_block(0, configs[c].cache_size, configs[c].block_size);
+        bench_start();
+        for (int f = 0; f < 20; ++f) {
+            char name[16];
+            sprintf(name, "f%d.txt", f);
+            CHECK(saveFileIntoFlash(&fs.lfs, name, data, 1000 + f * 100, &n));
+        }
+        bench_report(configs[c].name, 1);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+
+    printf("write a 1 MB file\n");
+    for (uint32_t c = 0; c < 3; c += 2) {
+        bench_chip();
+        bench_mount_block(0, 0, configs[c].block_size);
+        bench_start();
+        CHECK(lfs_file_open(&fs.lfs, &f, "big", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+        for (int i = 0; i < 64; ++i) {
+            CHECK(lfs_file_write(&fs.lfs, &f, data, 16384) == 16384);
+        }
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        bench_report(c ? "block_size 65536" : "block_size 4096", 1);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+}
+
+/*
+ * The 20 files of bench_write and a 256 KB file read back, with the caches
+ * and lookahead sized by littlefs_tune from RAM budgets of 1 to 8 KB
+ */
+static void bench_ram(void) {
+    static uint32_t ram[8192 / 4];
+    static char buf[1024];
+    lfs_file_t f;
+    size_t n;
+
+    printf("write 20 files, write and read 256 KB, by ram_size\n");
+    for (uint32_t ram_size = 1024; ram_size <= sizeof(ram); ram_size *= 2) {
+        bench_chip();
+        memset(&fs, 0, sizeof(fs));
+        fs.ram = (uint8_t *) ram;
+        fs.ram_size = ram_size;
+#if LFS_NAME_INDEX
+        fs.config.name_index_buffer = names;
+        fs.config.name_index_size = sizeof(names);
+#endif
+        CHECK(w25qxx_littlefs_init(&fs, &w25qxx, 0, 0) == 0);
+
+        bench_start();
+        for (int i = 0; i < 20; ++i) {
+            char name[16];
+            sprintf(name, "f%d.txt", i);
+            CHECK(saveFileIntoFlash(&fs.lfs, name, data, 1000 + i * 100, &n));
+        }
+        CHECK(lfs_file_open(&fs.lfs, &f, "stream", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+        for (int i = 0; i < 256; ++i) {
+            CHECK(lfs_file_write(&fs.lfs, &f, data, 1024) == 1024);
+        }
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        CHECK(lfs_file_open(&fs.lfs, &f, "stream", LFS_O_RDONLY) == 0);
+        for (int i = 0; i < 256; ++i) {
+            CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == sizeof(buf));
+        }
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+
+        char label[64];
+        sprintf(label, "ram %lu: cache %lu lookahead %lu", (unsigned long) ram_size,
+                (unsigned long) fs.config.cache_size, (unsigned long) fs.config.lookahead_size);
+        bench_report(label, 1);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+}
+
+/*
+ * Stream a 256 KB file with 10 us of overhead per HAL call
+ */
+static void bench_stream(void) {
+    lfs_file_t f;
+    static char buf[1024];
+
+    printf("stream a 256 KB file\n");
+    bench_chip();
+    bench_mount(0, 0);
+    CHECK(lfs_file_open(&fs.lfs, &f, "stream", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    for (int i = 0; i < 256; ++i) {
+        CHECK(lfs_file_write(&fs.lfs, &f, data, 1024) == 1024);
+    }
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    bench_remount();
+
+    flash_emu_call_us = 10;
+    bench_start();
+    CHECK(lfs_file_open(&fs.lfs, &f, "stream", LFS_O_RDONLY) == 0);
+    for (int i = 0; i < 256; ++i) {
+        CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == sizeof(buf));
+    }
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    bench_report("read", 1);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+static void bench_lookup(const char *what, const char *path, int exists) {
+    size_t n;
+
+    bench_start();
+    for (int i = 0; i < 20; ++i) {
+        if (what[0] == 'e') {
+            CHECK(fileExists(&fs.lfs, path) == exists);
+        } else {
+            CHECK(getFileSize(&fs.lfs, path, &n) == exists);
+        }
+    }
+    char label[64];
+    sprintf(label, "%s %s", what, path);
+    bench_report(label, 20);
+}
+
+#if LFS_NAME_INDEX
+/*
+ * Lookups in the 1000 file directory once the index has been built, with
+ * an index of size bytes
+ */
+static void bench_index(lfs_size_t size) {
+    static const char *paths[] = { "d/f0010", "d/f0500", "d/f0999", "d/none" };
+
+    fs.config.name_index_size = size;
+    bench_remount();
+    for (int i = 0; i < 4; ++i) {
+        CHECK(fileExists(&fs.lfs, paths[i]) == (i < 3));
+    }
+    printf("  built index of %lu bytes\n", (unsigned long) size);
+    for (int i = 0; i < 4; ++i) {
+        bench_lookup("exists", paths[i], i < 3);
+    }
+}
+#endif
+
+/*
+ * Path lookups in a small tree and in a 1000 file directory
+ */
+static void bench_lookups(void) {
+    size_t n;
+
+    printf("lookups, per call\n");
+    bench_chip();
+    bench_mount(0, 0);
+    CHECK(lfs_mkdir(&fs.lfs, "data") == 0);
+    CHECK(lfs_mkdir(&fs.lfs, "logs") == 0);
+    CHECK(lfs_mkdir(&fs.lfs, "logs/2026") == 0);
+    CHECK(lfs_mkdir(&fs.lfs, "logs/2026/10") == 0);
+    for (int f = 0; f < 30; ++f) {
+        char name[32];
+        sprintf(name, "cfg%d.txt", f);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 40, &n));
+    }
+    for (int f = 0; f < 100; ++f) {
+        char name[32];
+        sprintf(name, "data/s%03d.bin", f);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, f % 2 ? 600 : 100, &n));
+    }
+    for (int f = 0; f < 20; ++f) {
+        char name[32];
+        sprintf(name, "logs/2026/10/%02d.log", f);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 300, &n));
+    }
+    bench_remount();
+    bench_lookup("exists", "cfg7.txt", 1);
+    bench_lookup("exists", "data/s050.bin", 1);
+    bench_lookup("exists", "logs/2026/10/07.log", 1);
+    bench_lookup("size", "data/s051.bin", 1);
+    bench_lookup("size", "logs/2026/10/07.log", 1);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+
+    bench_chip();
+    bench_mount(0, 0);
+    CHECK(lfs_mkdir(&fs.lfs, "d") == 0);
+    for (int f = 0; f < 1000; ++f) {
+        char name[32];
+        sprintf(name, "d/f%04d", f);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 20, &n));
+    }
+    bench_remount();
+    bench_lookup("exists", "d/f0010", 1);
+    bench_lookup("exists", "d/f0500", 1);
+    bench_lookup("exists", "d/f0999", 1);
+    bench_lookup("exists", "d/none", 0);
+#if LFS_NAME_INDEX
+    bench_index(sizeof(names));
+    bench_index(sizeof(names) / 4);
+#endif
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+/*
+ * lfs_fs_size on 3000 files in two directories
+ */
+static void bench_fs_size(void) {
+    size_t n;
+
+    printf("lfs_fs_size, 3000 files\n");
+    bench_chip();
+    bench_mount(0, 0);
+    CHECK(lfs_mkdir(&fs.lfs, "a") == 0);
+    CHECK(lfs_mkdir(&fs.lfs, "b") == 0);
+    for (int f = 0; f < 3000; ++f) {
+        char name[24];
+        sprintf(name, "%s/f%d", f % 2 ? "a" : "b", f);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, f % 10 ? 60 : 9000, &n));
+    }
+    bench_remount();
+    for (int i = 0; i < 2; ++i) {
+        bench_start();
+        CHECK(lfs_fs_size(&fs.lfs) > 0);
+        bench_report(i ? "second call" : "first call", 1);
+    }
+
+    // polls between writes, as telemetry does
+    uint64_t us = 0, bytes = 0;
+    for (int f = 0; f < 20; ++f) {
+        char name[24];
+        sprintf(name, "a/f%d", f * 2 + 1);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 9000 - f * 400, &n));
+        bench_start();
+        CHECK(lfs_fs_size(&fs.lfs) > 0);
+        us += flash_emu_now - mark.now;
+        bytes += flash_emu_chips[0].bytes - mark.bytes;
+    }
+    printf("  %-34s %10llu us %9llu SPI bytes\n", "after each of 20 rewrites",
+            (unsigned long long) us / 20, (unsigned long long) bytes / 20);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+/*
+ * 100 appends of 4 KB after a remount on a 1024 block volume filled to
+ * 50 and 90 %, without and with w25qxx_littlefs_pre_erase run between
+ * appends as an idle loop would.  The idle time is left out of the report.
+ */
+static void bench_fill(void) {
+    printf("100 x 4 KB appends after remount, 1024 blocks\n");
+    for (int pct = 50; pct <= 90; pct += 40) {
+        for (int pre = 0; pre < 2; ++pre) {
+            lfs_file_t f;
+
+            bench_chip();
+            bench_mount(1025, 0);
+            uint32_t target = fs.config.block_count * pct / 100;
+            for (uint32_t i = 0; i < target / 16; ++i) {
+                char name[16];
+                sprintf(name, "fill%lu", (unsigned long) i);
+                CHECK(lfs_file_open(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT) == 0);
+                for (int k = 0; k < 16; ++k) {
+                    CHECK(lfs_file_write(&fs.lfs, &f, data, 4000) == 4000);
+                }
+                CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+            }
+#ifdef W25QXX_LITTLEFS_FREEMAP
+            CHECK(w25qxx_littlefs_save_freemap(&fs) == 0);
+#endif
+            CHECK(lfs_unmount(&fs.lfs) == 0);
+            bench_mount(1025, 0);
+
+            uint64_t worst = 0;
+            uint32_t histogram[5] = { 0 };
+            bench_start();
+            CHECK(lfs_file_open(&fs.lfs, &f, "log", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+            for (int k = 0; k < 100; ++k) {
+                if (pre) {
+                    uint64_t idle = flash_emu_now;
+                    while (w25qxx_littlefs_pre_erase(&fs) == 1) {
+                        flash_emu_advance(flash_emu_chips[0].busy_until - flash_emu_now);
+                    }
+                    mark.now += flash_emu_now - idle;
+                }
+                uint64_t start = flash_emu_now;
+                CHECK(lfs_file_write(&fs.lfs, &f, data, 4000) == 4000);
+                CHECK(lfs_file_sync(&fs.lfs, &f) == 0);
+                uint64_t time = flash_emu_now - start;
+                if (time > worst) {
+                    worst = time;
+                }
+                // by powers of two from 64 ms
+                uint32_t b = 0;
+                while (b < 4 && time >= (64000ULL << b)) {
+                    ++b;
+                }
+                ++histogram[b];
+            }
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+            char label[64];
+            sprintf(label, "fill %d%%%s, worst %llu us", pct, pre ? "+pre-erase" : "",
+                    (unsigned long long) worst);
+            bench_report(label, 1);
+            printf("    appends under 64 / 128 / 256 / 512 ms / more: %lu %lu %lu %lu %lu\n",
+                    (unsigned long) histogram[0], (unsigned long) histogram[1],
+                    (unsigned long) histogram[2], (unsigned long) histogram[3],
+                    (unsigned long) histogram[4]);
+            CHECK(lfs_unmount(&fs.lfs) == 0);
+        }
+    }
+}
+
+#ifdef W25QXX_DMA
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    w25qxx_spi_dma_complete(hspi);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    w25qxx_spi_dma_complete(hspi);
+}
+#endif
+
+static uint64_t idle_us;
+
+/*
+ * Stands in for other work run while the driver waits: 5 us at a time
+ */
+static void bench_yield(W25QXX_HandleTypeDef *handle) {
+    (void) handle;
+    flash_emu_advance(5);
+    idle_us += 5;
+}
+
+/*
+ * Raw 64 KB write and read in 4 KB calls with 10 us per HAL call, and the
+ * CPU time per KB left to the rest of the application by the yield hook
+ */
+static void bench_cpu(void) {
+    static uint8_t buf[4096];
+
+    printf("64 KB raw write and read, per KB\n");
+    bench_chip();
+    flash_emu_call_us = 10;
+    w25qxx.yield = bench_yield;
+    CHECK(w25qxx_erase(&w25qxx, 0, 64 << 10) == W25QXX_Ok);
+    for (int pass = 0; pass < 2; ++pass) {
+        idle_us = 0;
+        bench_start();
+        for (uint32_t address = 0; address < (64 << 10); address += sizeof(buf)) {
+            if (pass) {
+                CHECK(w25qxx_read(&w25qxx, address, buf, sizeof(buf)) == W25QXX_Ok);
+            } else {
+                CHECK(w25qxx_write(&w25qxx, address, (uint8_t *) data, sizeof(buf)) == W25QXX_Ok);
+            }
+        }
+        uint64_t busy = flash_emu_now - mark.now - idle_us;
+        char label[64];
+        sprintf(label, "%s, CPU busy %llu us", pass ? "read" : "write", (unsigned long long) busy / 64);
+        bench_report(label, 64);
+    }
+    w25qxx.yield = NULL;
+}
+
+/*
+ * Random 64 byte reads from a 4 MB file
+ */
+static void bench_seek(void) {
+    lfs_file_t f;
+    char buf[64];
+
+    printf("random 64 B reads from a 4 MB file, per read\n");
+    bench_chip();
+    bench_mount(0, 0);
+    CHECK(lfs_file_open(&fs.lfs, &f, "big", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    for (int i = 0; i < 1024; ++i) {
+        CHECK(lfs_file_write(&fs.lfs, &f, data, 4096) == 4096);
+    }
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+
+    srand(1);
+    CHECK(lfs_file_open(&fs.lfs, &f, "big", LFS_O_RDONLY) == 0);
+    bench_start();
+    for (int i = 0; i < 2000; ++i) {
+        lfs_soff_t pos = (rand() % (4 << 20) / 64) * 64;
+        CHECK(lfs_file_seek(&fs.lfs, &f, pos, LFS_SEEK_SET) == pos);
+        CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == sizeof(buf));
+    }
+    bench_report("read", 2000);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+/*
+ * Erase 256 KB, then write and read back a 512 KB file, on one chip and on
+ * two chips striped sector by sector
+ */
+static void bench_array(void) {
+    static W25QXX_HandleTypeDef second;
+    static W25QXX_HandleTypeDef *chips[2] = { &w25qxx, &second };
+    static W25QXX_ArrayTypeDef array;
+    static char buf[4096];
+    lfs_file_t f;
+
+    printf("512 KB file, 1 chip vs 2 striped chips\n");
+    for (uint32_t n = 1; n <= 2; ++n) {
+        flash_emu_call_us = 0;
+        test_chip(&w25qxx, 0, 16 << 20);
+        test_chip(&second, 1, 16 << 20);
+        CHECK(w25qxx_array_init(&array, chips, n, W25QXX_ARRAY_STRIPE, 4096) == W25QXX_Ok);
+
+        // until the last erase has finished on every chip
+        bench_start();
+        CHECK(w25qxx_array_erase(&array, 0, 256 << 10) == W25QXX_Ok);
+        uint64_t idle = flash_emu_chips[0].busy_until > flash_emu_chips[1].busy_until
+                ? flash_emu_chips[0].busy_until : flash_emu_chips[1].busy_until;
+        if (idle > flash_emu_now) {
+            flash_emu_advance(idle - flash_emu_now);
+        }
+        bench_report(n == 1 ? "erase 256 KB, 1 chip" : "erase 256 KB, 2 chips", 1);
+
+        memset(&fs, 0, sizeof(fs));
+        CHECK(w25qxx_littlefs_array_init(&fs, &array, 0, 1024) == 0);
+
+        bench_start();
+        CHECK(lfs_file_open(&fs.lfs, &f, "big", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+        for (int i = 0; i < 128; ++i) {
+            CHECK(lfs_file_write(&fs.lfs, &f, data, 4096) == 4096);
+        }
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        bench_report(n == 1 ? "write, 1 chip" : "write, 2 chips", 1);
+
+        bench_start();
+        CHECK(lfs_file_open(&fs.lfs, &f, "big", LFS_O_RDONLY) == 0);
+        for (int i = 0; i < 128; ++i) {
+            CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == sizeof(buf));
+        }
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        bench_report(n == 1 ? "read, 1 chip" : "read, 2 chips", 1);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (char) ('a' + i % 26);
+    }
+
+    printf("read-ahead %d, mdir cache %d, name index %d, ctz cache %d, freemap %s, dma %s\n",
+            W25QXX_LITTLEFS_READ_AHEAD_SIZE, LFS_MDIR_CACHE,
+            LFS_NAME_INDEX, LFS_CTZ_CACHE,
+#ifdef W25QXX_LITTLEFS_FREEMAP
+            "on",
+#else
+            "off",
+#endif
+#ifdef W25QXX_DMA
+            "on"
+#else
+            "off"
+#endif
+            );
+
+    bench_write();
+    bench_ram();
+    bench_stream();
+    bench_lookups();
+    bench_fs_size();
+    bench_fill();
+    bench_cpu();
+    bench_seek();
+    bench_array();
+    flash_emu_free();
+    return 0;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,532 @@
+/**
+ ******************************************************************************
+ * @file           : flash_emu.c
+ * @brief          : Emulated W25Qxx chips behind the host HAL stand-in
+ ******************************************************************************
+ * See flash_emu.h.  A chip sees the bytes of one transaction (CS low to CS
+ * high, or one QSPI command) one at a time; program and erase take effect when
+ * the transaction ends, which is also where a power cut tears them.
+ */
+
+#include "flash_emu.h"
+
+flash_emu_t flash_emu_chips[FLASH_EMU_CHIPS];
+uint64_t flash_emu_now;
+uint32_t flash_emu_call_us;
+uint8_t flash_emu_dma_lost;
+
+// Page program data is collected and applied when the transaction ends
+static uint8_t stage[256];
+static uint32_t stage_len;
+
+// Power cut after a number of program/erase operations
+static uint32_t power_ops;
+static uint32_t power_cut_at;
+static jmp_buf *power_env;
+
+// DMA transfer whose completion callback is still outstanding
+static struct {
+    SPI_HandleTypeDef *hspi;
+    uint64_t done;
+    uint8_t receive;
+} dma;
+
+static int busy(flash_emu_t *c) {
+    return flash_emu_now < c->busy_until;
+}
+
+static int has_address(uint8_t opcode) {
+    switch (opcode) {
+    case 0x03: case 0x0B: case 0x3B: case 0x6B: case 0x02: case 0x20: case 0x52: case 0xD8: case 0x5A:
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0x12: case 0x21: case 0x5C: case 0xDC:
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t address_bytes(flash_emu_t *c, uint8_t opcode) {
+    switch (opcode) {
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0x12: case 0x21: case 0x5C: case 0xDC:
+        return 4;
+    case 0x5A:
+        return 3;
+    }
+    return c->addr4 ? 4 : 3;
+}
+
+static uint32_t dummy_bytes(uint8_t opcode) {
+    switch (opcode) {
+    case 0x0B: case 0x0C: case 0x3B: case 0x3C: case 0x6B: case 0x6C: case 0x5A:
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t data_lines(uint8_t opcode) {
+    switch (opcode) {
+    case 0x3B: case 0x3C:
+        return 2;
+    case 0x6B: case 0x6C:
+        return 4;
+    }
+    return 1;
+}
+
+static uint32_t erase_size(uint8_t opcode) {
+    switch (opcode) {
+    case 0x20: case 0x21:
+        return 0x1000;
+    case 0x52: case 0x5C:
+        return 0x8000;
+    case 0xD8: case 0xDC:
+        return 0x10000;
+    }
+    return 0;
+}
+
+static void start(flash_emu_t *c) {
+    c->selected = 1;
+    c->index = 0;
+    c->lines = 1;
+    c->transactions++;
+    stage_len = 0;
+}
+
+/*
+ * Clock one byte of the current transaction
+ */
+static uint8_t clock_byte(flash_emu_t *c, uint8_t mosi) {
+    c->bytes++;
+
+    if (c->index == 0) {
+        c->opcode = mosi;
+        c->index = 1;
+        c->address = 0;
+        c->data_start = 1 + (has_address(mosi) ? address_bytes(c, mosi) : 0) + dummy_bytes(mosi);
+        c->commands[mosi]++;
+        if (busy(c) && mosi != 0x05 && mosi != 0x35 && mosi != 0x75) {
+            c->busy_violations++;
+        }
+        switch (mosi) {
+        case 0x06:
+            c->wel = 1;
+            break;
+        case 0xB7:
+            c->addr4 = 1;
+            break;
+        case 0xE9:
+            c->addr4 = 0;
+            break;
+        case 0x75:
+            if (busy(c) && !c->suspended) {
+                c->suspended = 1;
+                c->remaining = c->busy_until - flash_emu_now;
+                c->busy_until = flash_emu_now + FLASH_EMU_SUSPEND_US;
+            }
+            break;
+        case 0x7A:
+            if (c->suspended) {
+                c->suspended = 0;
+                c->busy_until = flash_emu_now + c->remaining;
+            }
+            break;
+        }
+        return 0xFF;
+    }
+
+    if (c->index < c->data_start) {
+        if (c->index <= (has_address(c->opcode) ? address_bytes(c, c->opcode) : 0)) {
+            c->address = (c->address << 8) | mosi;
+        }
+        c->index++;
+        return 0xFF;
+    }
+
+    uint32_t off = c->index++ - c->data_start;
+
+    switch (c->opcode) {
+    case 0x9F:
+        return off == 0 ? (uint8_t) (c->jedec >> 16) : off == 1 ? (uint8_t) (c->jedec >> 8) : (uint8_t) c->jedec;
+    case 0x05:
+        return (busy(c) ? 0x01 : 0) | (c->wel ? 0x02 : 0);
+    case 0x35:
+        return (c->qe ? 0x02 : 0) | (c->suspended ? 0x80 : 0);
+    case 0x31:
+        if (off == 0 && c->wel && !busy(c)) {
+            c->qe = (mosi & 0x02) != 0;
+            c->wel = 0;
+            c->busy_until = flash_emu_now + 10000;
+        }
+        return 0xFF;
+    case 0x03: case 0x13: case 0x0B: case 0x0C: case 0x3B: case 0x3C: case 0x6B: case 0x6C:
+        if (c->lines != data_lines(c->opcode) || (c->lines == 4 && !c->qe)) {
+            c->line_violations++;
+            return 0xFF;
+        }
+        if (busy(c)) {
+            return 0xFF;
+        }
+        return c->mem[(c->address + off) % c->size];
+    case 0x5A:
+        return c->address + off < c->sfdp_len ? c->sfdp[c->address + off] : 0xFF;
+    case 0x02: case 0x12:
+        if (stage_len < sizeof(stage)) {
+            stage[stage_len++] = mosi;
+        }
+        return 0xFF;
+    }
+    return 0xFF;
+}
+
+static void program(flash_emu_t *c, uint32_t len) {
+    uint32_t page = c->address & ~0xFFu;
+    for (uint32_t i = 0; i < len; ++i) {
+        uint32_t a = (page | ((c->address + i) & 0xFF)) % c->size;
+        if (a - c->bad_address < c->bad_len) {
+            continue;
+        }
+        c->mem[a] &= stage[i];
+    }
+}
+
+/*
+ * Count a program/erase and cut the power if it is the chosen one.  A torn
+ * operation leaves half its work done.
+ */
+static void power_check(flash_emu_t *c, uint32_t base, uint32_t size) {
+    if (power_env && power_ops == power_cut_at) {
+        jmp_buf *env = power_env;
+        power_env = NULL;
+        if (size) {
+            memset(c->mem + base, 0xFF, size / 2);
+        } else {
+            program(c, stage_len / 2);
+        }
+        c->selected = 0;
+        longjmp(*env, 1);
+    }
+    power_ops++;
+}
+
+/*
+ * CS high, i.e. the end of the current transaction
+ */
+static void finish(flash_emu_t *c) {
+    c->selected = 0;
+    if (c->index == 0 || !c->wel || busy(c)) {
+        return;
+    }
+
+    uint32_t size = erase_size(c->opcode);
+    if (size && c->index >= c->data_start) {
+        uint32_t base = (c->address & ~(size - 1)) % c->size;
+        power_check(c, base, size);
+        memset(c->mem + base, 0xFF, size);
+        c->busy_until = flash_emu_now + (size == 0x1000 ? FLASH_EMU_SECTOR_ERASE_US : size == 0x8000 ? FLASH_EMU_BLOCK32_ERASE_US : FLASH_EMU_BLOCK64_ERASE_US);
+        c->erases++;
+        c->wel = 0;
+    } else if (c->opcode == 0xC7 || c->opcode == 0x60) {
+        power_check(c, 0, c->size);
+        memset(c->mem, 0xFF, c->size);
+        c->busy_until = flash_emu_now + FLASH_EMU_CHIP_ERASE_US;
+        c->erases++;
+        c->wel = 0;
+    } else if ((c->opcode == 0x02 || c->opcode == 0x12) && stage_len) {
+        power_check(c, 0, 0);
+        program(c, stage_len);
+        c->busy_until = flash_emu_now + FLASH_EMU_PAGE_PROGRAM_US;
+        c->programs++;
+        c->program_bytes += stage_len;
+        c->wel = 0;
+    }
+}
+
+static flash_emu_t *selected(void) {
+    for (int i = 0; i < FLASH_EMU_CHIPS; ++i) {
+        if (flash_emu_chips[i].selected) {
+            return &flash_emu_chips[i];
+        }
+    }
+    return NULL;
+}
+
+static void clock_bytes(const uint8_t *tx, uint8_t *rx, uint32_t len) {
+    flash_emu_t *c = selected();
+    for (uint32_t i = 0; i < len; ++i) {
+        uint8_t miso = c ? clock_byte(c, tx ? tx[i] : 0xFF) : 0xFF;
+        if (rx) {
+            rx[i] = miso;
+        }
+    }
+}
+
+static void dma_check(void) {
+    if (dma.hspi && flash_emu_now >= dma.done) {
+        SPI_HandleTypeDef *hspi = dma.hspi;
+        dma.hspi = NULL;
+        if (flash_emu_dma_lost) {
+            return;
+        }
+        // Master receive runs as a full duplex transfer in the F0 HAL
+        if (dma.receive) {
+            HAL_SPI_TxRxCpltCallback(hspi);
+        } else {
+            HAL_SPI_TxCpltCallback(hspi);
+        }
+    }
+}
+
+void flash_emu_init(int chip, uint32_t size, uint32_t jedec) {
+    flash_emu_t *c = &flash_emu_chips[chip];
+    free(c->mem);
+    memset(c, 0, sizeof(*c));
+    c->size = size;
+    c->jedec = jedec;
+    c->mem = malloc(size);
+    memset(c->mem, 0xFF, size);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+/*
+ * SFDP image of a W25Q128JV scaled to the chip size: 4/32/64 KB erase, fast
+ * read 1-1-2 (0x3B) and 1-1-4 (0x6B), 256 byte pages.
+ */
+void flash_emu_sfdp(int chip) {
+    flash_emu_t *c = &flash_emu_chips[chip];
+    uint32_t bits = 0;
+    while ((1UL << bits) < c->size * 8) {
+        bits++;
+    }
+    uint32_t dw[11] = {
+            0xFFF920E5, 0x80000000 | bits, 0x6B08EB44, 0xBB423B08, 0xFFFFFFFE, 0xFF00FFFF,
+            0xFF00FFFF, 0x520F200C, 0x0000D810, 0x00000000, 0x00000080
+    };
+
+    memset(c->sfdp, 0xFF, sizeof(c->sfdp));
+    put32(c->sfdp, 0x50444653);
+    c->sfdp[4] = 6;
+    c->sfdp[5] = 1;
+    c->sfdp[6] = 0;
+    c->sfdp[8] = 0x00;
+    c->sfdp[9] = 6;
+    c->sfdp[10] = 1;
+    c->sfdp[11] = 11;
+    put32(c->sfdp + 12, 0xFF000080);
+    for (int i = 0; i < 11; ++i) {
+        put32(c->sfdp + 0x80 + 4 * i, dw[i]);
+    }
+    c->sfdp_len = 0x80 + 4 * 11;
+}
+
+void flash_emu_free(void) {
+    for (int i = 0; i < FLASH_EMU_CHIPS; ++i) {
+        free(flash_emu_chips[i].mem);
+        memset(&flash_emu_chips[i], 0, sizeof(flash_emu_chips[i]));
+    }
+}
+
+void flash_emu_advance(uint64_t us) {
+    flash_emu_now += us;
+    dma_check();
+}
+
+void flash_emu_power_cut(uint32_t ops, jmp_buf *env) {
+    power_cut_at = power_ops + ops;
+    power_env = env;
+}
+
+/*
+ * Power comes back: volatile device state is gone, the array is kept
+ */
+void flash_emu_power_on(void) {
+    power_env = NULL;
+    dma.hspi = NULL;
+    for (int i = 0; i < FLASH_EMU_CHIPS; ++i) {
+        flash_emu_t *c = &flash_emu_chips[i];
+        c->selected = 0;
+        c->wel = 0;
+        c->addr4 = 0;
+        c->suspended = 0;
+        c->busy_until = 0;
+    }
+}
+
+uint32_t flash_emu_power_ops(void) {
+    return power_ops;
+}
+
+/*
+ * HAL stand-in
+ */
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, int state) {
+    (void) pin;
+    flash_emu_t *c = &flash_emu_chips[port->chip];
+    if (state == GPIO_PIN_RESET) {
+        if (!c->selected) {
+            start(c);
+        }
+    } else if (c->selected) {
+        finish(c);
+    }
+}
+
+static HAL_StatusTypeDef spi(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx, uint16_t len) {
+    (void) hspi;
+    if (dma.hspi) {
+        return HAL_BUSY;
+    }
+    flash_emu_t *c = selected();
+    if (c) {
+        c->hal_calls++;
+    }
+    flash_emu_now += flash_emu_call_us + len;
+    clock_bytes(tx, rx, len);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len, uint32_t timeout) {
+    (void) timeout;
+    return spi(hspi, buf, NULL, len);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len, uint32_t timeout) {
+    (void) timeout;
+    return spi(hspi, NULL, buf, len);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t len, uint32_t timeout) {
+    (void) timeout;
+    return spi(hspi, tx, rx, len);
+}
+
+static HAL_StatusTypeDef spi_dma(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx, uint16_t len) {
+    if (dma.hspi) {
+        return HAL_BUSY;
+    }
+    flash_emu_t *c = selected();
+    if (c) {
+        c->dma_transfers++;
+    }
+    flash_emu_now += flash_emu_call_us;
+    clock_bytes(tx, rx, len);
+    dma.hspi = hspi;
+    dma.done = flash_emu_now + len;
+    dma.receive = rx != NULL;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len) {
+    return spi_dma(hspi, buf, NULL, len);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len) {
+    return spi_dma(hspi, NULL, buf, len);
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
+    if (dma.hspi == hspi) {
+        dma.hspi = NULL;
+    }
+    return HAL_OK;
+}
+
+__attribute__((weak)) void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+__attribute__((weak)) void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+/*
+ * QSPI: the instruction, address and dummy phase go out on one line, the
+ * data phase on cmd->DataMode lines.  CS is handled by the peripheral.
+ */
+static uint32_t qspi_remaining;
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t timeout) {
+    (void) timeout;
+    flash_emu_t *c = &flash_emu_chips[hqspi->chip];
+    uint8_t header[1 + 4 + 4];
+    uint32_t len = 0;
+
+    header[len++] = (uint8_t) cmd->Instruction;
+    if (cmd->AddressMode != QSPI_ADDRESS_NONE) {
+        for (uint32_t i = cmd->AddressSize; i > 0; --i) {
+            header[len++] = (uint8_t) (cmd->Address >> (8 * (i - 1)));
+        }
+    }
+    for (uint32_t i = 0; i < cmd->DummyCycles / 8; ++i) {
+        header[len++] = 0xFF;
+    }
+
+    c->hal_calls++;
+    flash_emu_now += flash_emu_call_us + len;
+    start(c);
+    for (uint32_t i = 0; i < len; ++i) {
+        clock_byte(c, header[i]);
+    }
+
+    if (cmd->DataMode == QSPI_DATA_NONE) {
+        finish(c);
+    } else {
+        c->lines = (uint8_t) cmd->DataMode;
+        qspi_remaining = cmd->NbData;
+    }
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef qspi_data(QSPI_HandleTypeDef *hqspi, const uint8_t *tx, uint8_t *rx) {
+    flash_emu_t *c = &flash_emu_chips[hqspi->chip];
+    if (!c->selected) {
+        return HAL_ERROR;
+    }
+    c->hal_calls++;
+    flash_emu_now += flash_emu_call_us + (qspi_remaining + c->lines - 1) / c->lines;
+    for (uint32_t i = 0; i < qspi_remaining; ++i) {
+        uint8_t miso = clock_byte(c, tx ? tx[i] : 0xFF);
+        if (rx) {
+            rx[i] = miso;
+        }
+    }
+    finish(c);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *buf, uint32_t timeout) {
+    (void) timeout;
+    return qspi_data(hqspi, NULL, buf);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *buf, uint32_t timeout) {
+    (void) timeout;
+    return qspi_data(hqspi, buf, NULL);
+}
+
+uint32_t HAL_GetTick(void) {
+    flash_emu_advance(1);
+    return (uint32_t) (flash_emu_now / 1000);
+}
+
+void HAL_Delay(uint32_t delay) {
+    flash_emu_advance((uint64_t) delay * 1000);
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
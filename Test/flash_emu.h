@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * @file           : flash_emu.h
+ * @brief          : Emulated W25Qxx chips behind the host HAL stand-in
+ ******************************************************************************
+ * Each chip decodes the commands the driver sends: ID, status registers,
+ * normal/fast/dual/quad read (3 and 4 byte address), SFDP, page program,
+ * 4/32/64 KB and chip erase, suspend/resume and 4 byte mode.  Programs only
+ * clear bits and erases set whole sectors back to 0xFF.
+ *
+ * Time is simulated in microseconds.  A byte on one data line takes 1 us
+ * (8 MHz SPI), dual and quad data phases take a half and a quarter of that.
+ * Page program, sector and block erases keep the chip busy for the typical
+ * datasheet times and HAL_GetTick() derives the tick from the same clock.
+ *
+ * DMA transfers move their data right away but only call the completion
+ * callback once the transfer time has passed, from within HAL_GetTick() or
+ * HAL_Delay(), i.e. while the driver waits for it.
+ */
+
+#ifndef FLASH_EMU_H_
+#define FLASH_EMU_H_
+
+#include "main.h"
+#include <setjmp.h>
+
+#define FLASH_EMU_CHIPS 4
+
+#define FLASH_EMU_PAGE_PROGRAM_US 700
+#define FLASH_EMU_SECTOR_ERASE_US 45000
+#define FLASH_EMU_BLOCK32_ERASE_US 120000
+#define FLASH_EMU_BLOCK64_ERASE_US 150000
+#define FLASH_EMU_CHIP_ERASE_US   20000000
+#define FLASH_EMU_SUSPEND_US      20
+
+typedef struct {
+    uint8_t *mem;
+    uint32_t size;
+    uint32_t jedec;                   // Manufacturer << 16 | device ID
+    uint8_t sfdp[256];
+    uint32_t sfdp_len;                // 0: SFDP reads return 0xFF
+    uint32_t bad_address;             // Programs in [bad_address, + bad_len) have no effect
+    uint32_t bad_len;
+
+    // Device state
+    uint8_t wel;
+    uint8_t addr4;
+    uint8_t qe;
+    uint8_t suspended;
+    uint64_t busy_until;
+    uint64_t remaining;               // Busy time left when suspended
+
+    // Current transaction
+    uint8_t selected;
+    uint8_t opcode;
+    uint32_t index;
+    uint32_t address;
+    uint32_t data_start;
+    uint8_t lines;                    // Data lines of a QSPI data phase
+
+    // Counters
+    uint64_t bytes;                   // Bytes clocked in either direction
+    uint64_t hal_calls;               // Blocking HAL SPI/QSPI calls
+    uint64_t dma_transfers;
+    uint64_t transactions;            // CS assertions
+    uint64_t commands[256];
+    uint64_t programs;
+    uint64_t program_bytes;
+    uint64_t erases;
+    uint64_t busy_violations;         // Commands other than status/suspend while busy
+    uint64_t line_violations;         // Dual/quad read with the wrong bus width or QE clear
+} flash_emu_t;
+
+extern flash_emu_t flash_emu_chips[FLASH_EMU_CHIPS];
+extern uint64_t flash_emu_now;        // Simulated time in us
+extern uint32_t flash_emu_call_us;    // Overhead of every HAL SPI call
+extern uint8_t flash_emu_dma_lost;    // Drop DMA completion callbacks
+
+void flash_emu_init(int chip, uint32_t size, uint32_t jedec);
+void flash_emu_sfdp(int chip);
+void flash_emu_free(void);
+void flash_emu_advance(uint64_t us);
+
+void flash_emu_power_cut(uint32_t ops, jmp_buf *env);
+void flash_emu_power_on(void);
+uint32_t flash_emu_power_ops(void);
+
+#endif /* FLASH_EMU_H_ */
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,99 @@
+/**
+ ******************************************************************************
+ * @file           : main.h
+ * @brief          : Host stand-in for the HAL parts the flash drivers use
+ ******************************************************************************
+ * The drivers include "main.h" for the STM32 HAL.  Host builds put this
+ * directory first on the include path so they get these declarations instead,
+ * implemented by flash_emu.c.
+ */
+
+#ifndef HOST_MAIN_H_
+#define HOST_MAIN_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    HAL_OK = 0,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+typedef struct {
+    int chip;                         // Emulated chip selected by this port
+} GPIO_TypeDef;
+
+#define GPIO_PIN_RESET 0
+#define GPIO_PIN_SET   1
+#define GPIO_PIN_4     0x0010
+
+typedef struct {
+    int bus;
+} SPI_HandleTypeDef;
+
+typedef struct {
+    int chip;                         // Emulated chip wired to this interface
+} QSPI_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instruction;
+    uint32_t Address;
+    uint32_t AlternateBytes;
+    uint32_t AddressSize;
+    uint32_t AlternateBytesSize;
+    uint32_t DummyCycles;
+    uint32_t InstructionMode;
+    uint32_t AddressMode;
+    uint32_t AlternateByteMode;
+    uint32_t DataMode;
+    uint32_t NbData;
+    uint32_t DdrMode;
+    uint32_t DdrHoldHalfCycle;
+    uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+#define QSPI_INSTRUCTION_1_LINE   1
+#define QSPI_ADDRESS_NONE         0
+#define QSPI_ADDRESS_1_LINE       1
+#define QSPI_ADDRESS_24_BITS      3
+#define QSPI_ADDRESS_32_BITS      4
+#define QSPI_ALTERNATE_BYTES_NONE 0
+#define QSPI_DATA_NONE            0
+#define QSPI_DATA_1_LINE          1
+#define QSPI_DATA_2_LINES         2
+#define QSPI_DATA_4_LINES         4
+#define QSPI_DDR_MODE_DISABLE     0
+#define QSPI_DDR_HHC_ANALOG_DELAY 0
+#define QSPI_SIOO_INST_EVERY_CMD  0
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, int state);
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *buf, uint16_t len);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *buf, uint32_t timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *buf, uint32_t timeout);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+
+#endif /* HOST_MAIN_H_ */
+
+/*
+ * vim: ts=4 et nowrap
+ */
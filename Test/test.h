@@ -0,0 +1,58 @@
+/**
+ ******************************************************************************
+ * @file           : test.h
+ * @brief          : Helpers shared by the host tests and benchmarks
+ ******************************************************************************
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include "flash_emu.h"
+#include "w25qxx.h"
+
+#define CHECK(x) do { \
+        if (!(x)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define RUN(test) do { \
+        printf("%s\n", #test); \
+        test(); \
+    } while (0)
+
+#ifdef W25QXX_QSPI
+static QSPI_HandleTypeDef test_qspi[FLASH_EMU_CHIPS] = { { 0 }, { 1 }, { 2 }, { 3 } };
+#else
+static SPI_HandleTypeDef test_spi;
+static GPIO_TypeDef test_port[FLASH_EMU_CHIPS] = { { 0 }, { 1 }, { 2 }, { 3 } };
+#endif
+
+/*
+ * Initialize the driver for an emulated chip, as after an MCU reset
+ */
+static inline void test_init(W25QXX_HandleTypeDef *w25qxx, int chip) {
+    memset(w25qxx, 0, sizeof(*w25qxx));
+#ifdef W25QXX_QSPI
+    CHECK(w25qxx_init(w25qxx, &test_qspi[chip]) == W25QXX_Ok);
+#else
+    CHECK(w25qxx_init(w25qxx, &test_spi, &test_port[chip], GPIO_PIN_4) == W25QXX_Ok);
+#endif
+}
+
+/*
+ * Fresh erased chip with an SFDP table, initialized with the driver
+ */
+static inline void test_chip(W25QXX_HandleTypeDef *w25qxx, int chip, uint32_t size) {
+    flash_emu_init(chip, size, 0xEF4018);
+    flash_emu_sfdp(chip);
+    test_init(w25qxx, chip);
+}
+
+#endif /* TEST_H_ */
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,154 @@
+/**
+ ******************************************************************************
+ * @file           : test_array.c
+ * @brief          : Host tests of chip arrays and littlefs on top of them
+ ******************************************************************************
+ */
+
+#include "test.h"
+#include "w25qxx_array.h"
+#include "w25qxx_littlefs.h"
+
+#define STRIPE 8192
+
+static W25QXX_HandleTypeDef w25qxx[2];
+static W25QXX_HandleTypeDef *chips[2] = { &w25qxx[0], &w25qxx[1] };
+static W25QXX_ArrayTypeDef array;
+static W25QXX_LittleFSTypeDef fs;
+static uint8_t data[3 * STRIPE];
+static uint8_t buf[3 * STRIPE];
+
+static void pattern(uint8_t *p, uint32_t seed, uint32_t len) {
+    for (uint32_t i = 0; i < len; ++i) {
+        p[i] = (uint8_t) (seed + i * 7 + i / 251);
+    }
+}
+
+static int erased(const uint8_t *p, uint32_t len) {
+    for (uint32_t i = 0; i < len; ++i) {
+        if (p[i] != 0xFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * A 1 MB and a 2 MB chip back to back: ranges across the join go to the
+ * end of the first chip and the start of the second
+ */
+static void test_concat(void) {
+    const uint32_t join = 1 << 20;
+
+    test_chip(&w25qxx[0], 0, 1 << 20);
+    test_chip(&w25qxx[1], 1, 2 << 20);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_CONCAT, 0) == W25QXX_Ok);
+    CHECK(array.size == (3 << 20));
+
+    pattern(data, 1, 300);
+    CHECK(w25qxx_array_write(&array, join - 100, data, 300) == W25QXX_Ok);
+    CHECK(!memcmp(&flash_emu_chips[0].mem[join - 100], data, 100));
+    CHECK(!memcmp(&flash_emu_chips[1].mem[0], data + 100, 200));
+    CHECK(w25qxx_array_read(&array, join - 100, buf, 300) == W25QXX_Ok);
+    CHECK(!memcmp(buf, data, 300));
+
+    // Last byte of the array, then one past it
+    CHECK(w25qxx_array_write(&array, array.size - 1, data, 1) == W25QXX_Ok);
+    CHECK(flash_emu_chips[1].mem[(2 << 20) - 1] == data[0]);
+    CHECK(w25qxx_array_write(&array, array.size - 1, data, 2) == W25QXX_Err);
+    CHECK(w25qxx_array_read(&array, array.size, buf, 1) == W25QXX_Err);
+
+    CHECK(w25qxx_array_erase(&array, join - 4096, 8192) == W25QXX_Ok);
+    CHECK(erased(&flash_emu_chips[0].mem[join - 4096], 4096));
+    CHECK(erased(&flash_emu_chips[1].mem[0], 4096));
+    CHECK(flash_emu_chips[0].busy_violations == 0 && flash_emu_chips[1].busy_violations == 0);
+}
+
+/*
+ * Two 1 MB chips dealt out in 8 KB stripes: a range over three stripes
+ * ends on chip 0, fills a stripe of chip 1 and starts the next stripe of
+ * chip 0
+ */
+static void test_stripe(void) {
+    test_chip(&w25qxx[0], 0, 1 << 20);
+    test_chip(&w25qxx[1], 1, 1 << 20);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_STRIPE, 1000) == W25QXX_Err);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_STRIPE, 3 * 4096) == W25QXX_Err);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_STRIPE, STRIPE) == W25QXX_Ok);
+    CHECK(array.size == (2 << 20));
+
+    pattern(data, 2, STRIPE + 100);
+    CHECK(w25qxx_array_write(&array, STRIPE - 50, data, STRIPE + 100) == W25QXX_Ok);
+    CHECK(!memcmp(&flash_emu_chips[0].mem[STRIPE - 50], data, 50));
+    CHECK(!memcmp(&flash_emu_chips[1].mem[0], data + 50, STRIPE));
+    CHECK(!memcmp(&flash_emu_chips[0].mem[STRIPE], data + 50 + STRIPE, 50));
+    CHECK(w25qxx_array_read(&array, STRIPE - 50, buf, STRIPE + 100) == W25QXX_Ok);
+    CHECK(!memcmp(buf, data, STRIPE + 100));
+
+    // The last stripe belongs to chip 1
+    CHECK(w25qxx_array_write(&array, array.size - 10, data, 10) == W25QXX_Ok);
+    CHECK(!memcmp(&flash_emu_chips[1].mem[(1 << 20) - 10], data, 10));
+    CHECK(w25qxx_array_write(&array, array.size - 10, data, 11) == W25QXX_Err);
+
+    // Stripes 1 and 2 erase sectors on both chips
+    CHECK(w25qxx_array_erase(&array, STRIPE, 2 * STRIPE) == W25QXX_Ok);
+    CHECK(erased(&flash_emu_chips[1].mem[0], STRIPE));
+    CHECK(erased(&flash_emu_chips[0].mem[STRIPE], STRIPE));
+    CHECK(!memcmp(&flash_emu_chips[0].mem[STRIPE - 50], data, 50));
+
+    // Chips of different sizes can't be striped
+    test_chip(&w25qxx[1], 1, 2 << 20);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_STRIPE, STRIPE) == W25QXX_Err);
+    CHECK(flash_emu_chips[0].busy_violations == 0 && flash_emu_chips[1].busy_violations == 0);
+}
+
+/*
+ * littlefs on two striped chips keeps its files across a remount and
+ * spreads its blocks over both chips
+ */
+static void test_littlefs_array(void) {
+    lfs_file_t f;
+
+    test_chip(&w25qxx[0], 0, 1 << 20);
+    test_chip(&w25qxx[1], 1, 1 << 20);
+    CHECK(w25qxx_array_init(&array, chips, 2, W25QXX_ARRAY_STRIPE, 4096) == W25QXX_Ok);
+    memset(&fs, 0, sizeof(fs));
+    CHECK(w25qxx_littlefs_array_init(&fs, &array, 0, 0) == 0);
+    CHECK(fs.config.block_count == (2 << 20) / 4096);
+    for (int i = 0; i < 8; ++i) {
+        char name[16];
+        sprintf(name, "f%d", i);
+        pattern(data, i, sizeof(data));
+        CHECK(lfs_file_open(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT) == 0);
+        CHECK(lfs_file_write(&fs.lfs, &f, data, sizeof(data)) == sizeof(data));
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+
+    memset(&fs, 0, sizeof(fs));
+    CHECK(w25qxx_littlefs_array_init(&fs, &array, 0, 0) == 0);
+    for (int i = 0; i < 8; ++i) {
+        char name[16];
+        sprintf(name, "f%d", i);
+        pattern(data, i, sizeof(data));
+        CHECK(lfs_file_open(&fs.lfs, &f, name, LFS_O_RDONLY) == 0);
+        CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == sizeof(buf));
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        CHECK(!memcmp(buf, data, sizeof(data)));
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    CHECK(flash_emu_chips[0].programs > 0 && flash_emu_chips[1].programs > 0);
+    CHECK(flash_emu_chips[0].busy_violations == 0 && flash_emu_chips[1].busy_violations == 0);
+}
+
+int main(void) {
+    RUN(test_concat);
+    RUN(test_stripe);
+    RUN(test_littlefs_array);
+    flash_emu_free();
+    return 0;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
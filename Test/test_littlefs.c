@@ -0,0 +1,713 @@
+/**
+ ******************************************************************************
+ * @file           : test_littlefs.c
+ * @brief          : Host tests of littlefs on the W25Qxx LLD
+ ******************************************************************************
+ */
+
+#include "test.h"
+#include "lfs.h"
+#include "w25qxx_littlefs.h"
+#include "LFS_wrapper.h"
+
+#define TEST_BLOCKS 64
+#define TEST_FILES  4
+
+static W25QXX_HandleTypeDef w25qxx;
+static W25QXX_LittleFSTypeDef fs;
+static uint32_t ram[2048 / 4];
+static uint8_t file_buffer[W25QXX_LITTLEFS_CACHE_MAX];
+static const struct lfs_file_config file_config = { .buffer = file_buffer };
+#if LFS_NAME_INDEX
+static uint32_t names[3 * 512];
+#endif
+static uint8_t data[16384];
+static uint8_t buf[16384];
+
+/*
+ * (Re)mount with all buffers static, so nothing leaks when a power cut
+ * abandons the filesystem halfway through an operation
+ */
+static void test_mount_cache(uint32_t blocks, lfs_size_t cache_size) {
+    memset(&fs, 0, sizeof(fs));
+    fs.ram = (uint8_t *) ram;
+    fs.ram_size = sizeof(ram);
+    fs.config.read_size = cache_size;
+    fs.config.prog_size = cache_size;
+    fs.config.cache_size = cache_size;
+#if LFS_NAME_INDEX
+    fs.config.name_index_buffer = names;
+    fs.config.name_index_size = sizeof(names);
+#endif
+    CHECK(w25qxx_littlefs_init(&fs, &w25qxx, 0, blocks) == 0);
+}
+
+static void test_mount(uint32_t blocks) {
+    test_mount_cache(blocks, 0);
+}
+
+static uint32_t version_len(int file, uint32_t version) {
+    return 4 + (file * 977 + version * 1531) % 6000;
+}
+
+static void pattern(uint8_t *p, int file, uint32_t version, uint32_t len) {
+    memcpy(p, &version, 4);
+    for (uint32_t i = 4; i < len; ++i) {
+        p[i] = (uint8_t) (file * 131 + version * 31 + i * 7);
+    }
+}
+
+static void write_version(int file, uint32_t version) {
+    char name[16];
+    lfs_file_t f;
+    uint32_t len = version_len(file, version);
+
+    sprintf(name, "f%d", file);
+    pattern(data, file, version, len);
+    CHECK(lfs_file_opencfg(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_config) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, data, len) == (lfs_ssize_t) len);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+}
+
+static void append_record(uint32_t record) {
+    lfs_file_t f;
+    uint8_t r[16];
+
+    memset(r, (uint8_t) record, sizeof(r));
+    memcpy(r, &record, 4);
+    CHECK(lfs_file_opencfg(&fs.lfs, &f, "log", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND, &file_config) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, r, sizeof(r)) == sizeof(r));
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+}
+
+/*
+ * Every file holds one complete version and the log whole records in order
+ */
+static void verify_files(void) {
+    lfs_file_t f;
+
+    for (int file = 0; file < TEST_FILES; ++file) {
+        char name[16];
+        uint32_t version;
+        sprintf(name, "f%d", file);
+        CHECK(lfs_file_opencfg(&fs.lfs, &f, name, LFS_O_RDONLY, &file_config) == 0);
+        lfs_ssize_t len = lfs_file_read(&fs.lfs, &f, buf, sizeof(buf));
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        CHECK(len >= 4);
+        memcpy(&version, buf, 4);
+        CHECK((uint32_t) len == version_len(file, version));
+        pattern(data, file, version, len);
+        CHECK(!memcmp(buf, data, len));
+    }
+
+    int err = lfs_file_opencfg(&fs.lfs, &f, "log", LFS_O_RDONLY, &file_config);
+    if (err == LFS_ERR_NOENT) {
+        return;
+    }
+    CHECK(err == 0);
+    lfs_ssize_t len = lfs_file_read(&fs.lfs, &f, buf, sizeof(buf));
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(len >= 0 && len % 16 == 0);
+    for (lfs_ssize_t i = 0; i < len; i += 16) {
+        uint32_t record;
+        memcpy(&record, buf + i, 4);
+        CHECK(record == (uint32_t) i / 16);
+    }
+}
+
+static void workload(void) {
+    for (uint32_t version = 1; version <= 4; ++version) {
+        for (int file = 0; file < TEST_FILES; ++file) {
+            write_version(file, version);
+            append_record((version - 1) * TEST_FILES + file);
+        }
+        if (version % 2) {
+            CHECK(lfs_mkdir(&fs.lfs, "tmp") == 0);
+        } else {
+            CHECK(lfs_remove(&fs.lfs, "tmp") == 0);
+        }
+    }
+}
+
+static void test_files(void) {
+    size_t n;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount(TEST_BLOCKS);
+    for (int f = 0; f < 20; ++f) {
+        char name[24];
+        sprintf(name, "f%d.txt", f);
+        pattern(data, f, 0, 1000 + f * 100);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 1000 + f * 100, &n));
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    test_mount(TEST_BLOCKS);
+    for (int f = 0; f < 20; ++f) {
+        char name[24];
+        sprintf(name, "f%d.txt", f);
+        CHECK(getFileSize(&fs.lfs, name, &n) && n == (size_t) (1000 + f * 100));
+        CHECK(readFilefromFlash(&fs.lfs, name, sizeof(buf), (char *) buf, &n) && n == (size_t) (1000 + f * 100));
+        pattern(data, f, 0, n);
+        CHECK(!memcmp(buf, data, n));
+    }
+    CHECK(appendDataAtTheEndOfFile(&fs.lfs, "f1.txt", "XYZ", 3, &n));
+    CHECK(getFileSize(&fs.lfs, "f1.txt", &n) && n == 1103);
+    CHECK(deleteFilefromFlash(&fs.lfs, "f3.txt"));
+    CHECK(!fileExists(&fs.lfs, "f3.txt"));
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    CHECK(flash_emu_chips[0].busy_violations == 0);
+}
+
+/*
+ * Blocks whose programs don't stick must be caught by littlefs reading its
+ * progs back, and their data moved elsewhere
+ */
+static void test_bad_blocks(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+    char name[24];
+    size_t n;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount_cache(TEST_BLOCKS, 64);
+    chip->bad_address = 16 * 4096;
+    chip->bad_len = 16 * 4096;
+    for (int f = 0; f < 40; ++f) {
+        sprintf(name, "f%d.txt", f);
+        pattern(data, f, 0, 500);
+        CHECK(saveFileIntoFlash(&fs.lfs, name, data, 500, &n));
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+
+    test_mount_cache(TEST_BLOCKS, 64);
+    for (int f = 0; f < 40; ++f) {
+        sprintf(name, "f%d.txt", f);
+        CHECK(readFilefromFlash(&fs.lfs, name, sizeof(buf), (char *) buf, &n) && n == 500);
+        pattern(data, f, 0, n);
+        CHECK(!memcmp(buf, data, n));
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    chip->bad_len = 0;
+}
+
+/*
+ * Cut the power at every program/erase of a workload, then check the
+ * filesystem mounts without a format, holds consistent files and can still
+ * be written
+ */
+static void test_power_loss(void) {
+    static uint8_t image[2 << 20];
+    flash_emu_t *chip = &flash_emu_chips[0];
+    jmp_buf env;
+
+    test_chip(&w25qxx, 0, sizeof(image));
+    test_mount(TEST_BLOCKS);
+    for (int file = 0; file < TEST_FILES; ++file) {
+        write_version(file, 0);
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    memcpy(image, chip->mem, sizeof(image));
+
+    uint32_t ops = flash_emu_power_ops();
+    test_mount(TEST_BLOCKS);
+    workload();
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    ops = flash_emu_power_ops() - ops;
+
+    for (uint32_t cut = 0; cut < ops; ++cut) {
+        memcpy(chip->mem, image, sizeof(image));
+        flash_emu_power_on();
+        test_init(&w25qxx, 0);
+        test_mount(TEST_BLOCKS);
+        if (!setjmp(env)) {
+            flash_emu_power_cut(cut, &env);
+            workload();
+            flash_emu_power_cut(0, NULL);
+            CHECK(lfs_unmount(&fs.lfs) == 0);
+        }
+        flash_emu_power_on();
+        test_init(&w25qxx, 0);
+
+        // A mount failure would format, which verify_files catches
+        test_mount(TEST_BLOCKS);
+        verify_files();
+
+        write_version(cut % TEST_FILES, 9);
+        append_record(0xFFFF);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+        test_mount(TEST_BLOCKS);
+        CHECK(lfs_mkdir(&fs.lfs, "after") == 0);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+    printf("  %lu power cuts\n", (unsigned long) ops);
+}
+
+/*
+ * Create names that sort into every pair of a split directory while the
+ * name index holds those pairs, then look each one up after a remount
+ */
+static void split_dir(const char *format) {
+    char name[40];
+    struct lfs_info info;
+    lfs_dir_t dir;
+    lfs_file_t f;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount(TEST_BLOCKS);
+    CHECK(lfs_mkdir(&fs.lfs, "d") == 0);
+    for (int i = 0; i < 400; i += 2) {
+        sprintf(name, format, i);
+        write_version(0, 0);
+        CHECK(lfs_rename(&fs.lfs, "f0", name) == 0);
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+
+    test_mount(TEST_BLOCKS);
+    for (int i = 0; i < 400; i += 2) {
+        sprintf(name, format, i);
+        CHECK(lfs_stat(&fs.lfs, name, &info) == 0);
+    }
+    for (int i = 0; i < 400; i += 2) {
+        int j = (i * 37) % 400 + 1;
+        sprintf(name, format, j);
+        CHECK(lfs_stat(&fs.lfs, name, &info) == LFS_ERR_NOENT);
+        CHECK(lfs_file_opencfg(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL, &file_config) == 0);
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        CHECK(lfs_stat(&fs.lfs, name, &info) == 0 && info.size == 0);
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+
+    test_mount(TEST_BLOCKS);
+    for (int i = 0; i < 400; ++i) {
+        sprintf(name, format, i);
+        CHECK(lfs_stat(&fs.lfs, name, &info) == 0);
+        CHECK(info.size == (i % 2 ? 0 : version_len(0, 0)));
+        CHECK(lfs_mkdir(&fs.lfs, name) == LFS_ERR_EXIST);
+    }
+
+    // Listed once each, in order
+    int count = 0;
+    CHECK(lfs_dir_open(&fs.lfs, &dir, "d") == 0);
+    while (lfs_dir_read(&fs.lfs, &dir, &info) > 0) {
+        if (info.name[0] == '.') {
+            continue;
+        }
+        sprintf(name, format + 2, count++);
+        CHECK(!strcmp(info.name, name));
+    }
+    CHECK(lfs_dir_close(&fs.lfs, &dir) == 0);
+    CHECK(count == 400);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+static void test_split_dir(void) {
+    split_dir("d/file%04d");
+    // names sharing more than the 8 bytes the name index keeps of them
+    split_dir("d/file-with-a-long-name-%04d");
+}
+
+/*
+ * Fill a small volume so the allocator runs out of known free blocks in the
+ * middle of operations that hold blocks not yet in the tree (new directory
+ * pairs, relocations), then check nothing was handed out twice and blocks
+ * freed since the last traversal are still found
+ */
+static void test_full_volume(void) {
+    char name[32];
+    struct lfs_info info;
+    lfs_file_t f;
+    uint32_t live[6] = { 0 };
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount(32);
+    for (uint32_t i = 1; i < 400; ++i) {
+        uint32_t slot = (i * 5) % 6;
+        if (live[slot]) {
+            sprintf(name, "d%lu/f", (unsigned long) live[slot]);
+            CHECK(lfs_remove(&fs.lfs, name) == 0);
+            sprintf(name, "d%lu", (unsigned long) live[slot]);
+            CHECK(lfs_remove(&fs.lfs, name) == 0);
+            live[slot] = 0;
+        }
+        sprintf(name, "d%lu", (unsigned long) i);
+        CHECK(lfs_mkdir(&fs.lfs, name) == 0);
+        sprintf(name, "d%lu/f", (unsigned long) i);
+        uint32_t len = 5000 + i % 3000;
+        pattern(data, 1, i, len);
+        CHECK(lfs_file_opencfg(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT, &file_config) == 0);
+        CHECK(lfs_file_write(&fs.lfs, &f, data, len) == (lfs_ssize_t) len);
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        live[slot] = i;
+
+        if (i % 50 == 0) {
+#ifdef W25QXX_LITTLEFS_FREEMAP
+            CHECK(w25qxx_littlefs_save_freemap(&fs) == 0);
+#endif
+            CHECK(lfs_unmount(&fs.lfs) == 0);
+            test_mount(32);
+        }
+        for (uint32_t s = 0; s < 6; ++s) {
+            if (!live[s]) {
+                continue;
+            }
+            len = 5000 + live[s] % 3000;
+            sprintf(name, "d%lu/f", (unsigned long) live[s]);
+            CHECK(lfs_stat(&fs.lfs, name, &info) == 0 && info.size == len);
+            CHECK(lfs_file_opencfg(&fs.lfs, &f, name, LFS_O_RDONLY, &file_config) == 0);
+            CHECK(lfs_file_read(&fs.lfs, &f, buf, len) == (lfs_ssize_t) len);
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+            pattern(data, 1, live[s], len);
+            CHECK(!memcmp(buf, data, len));
+        }
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+/*
+ * Blocks in use as counted from scratch by a second mount
+ */
+static lfs_ssize_t fresh_size(void) {
+    struct lfs_config cfg = fs.config;
+    lfs_t check;
+
+    cfg.read_buffer = NULL;
+    cfg.prog_buffer = NULL;
+    cfg.lookahead_buffer = NULL;
+    cfg.freemap_buffer = NULL;
+    cfg.name_index_buffer = NULL;
+    CHECK(lfs_mount(&check, &cfg) == 0);
+    lfs_ssize_t size = lfs_fs_size(&check);
+    CHECK(lfs_unmount(&check) == 0);
+    return size;
+}
+
+/*
+ * lfs_fs_size keeps its count up to date as blocks are allocated and
+ * dropped, so after every operation it must match a fresh traversal.
+ * Small block_cycles and a bad range make directories and files relocate.
+ */
+static void test_used_blocks(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+    char name[16], other[16];
+    lfs_file_t f, g;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    memset(&fs, 0, sizeof(fs));
+    fs.config.block_cycles = 5;
+    CHECK(w25qxx_littlefs_init(&fs, &w25qxx, 0, TEST_BLOCKS) == 0);
+    CHECK(lfs_fs_size(&fs.lfs) > 0);
+    srand(7);
+    for (int step = 0; step < 600; ++step) {
+        int op = rand() % 8;
+        lfs_size_t len = rand() % 12000;
+        sprintf(name, "f%d", rand() % 6);
+        if (step == 300) {
+            chip->bad_address = 40 * 4096;
+            chip->bad_len = 8 * 4096;
+        }
+        if (op == 0 || op == 1) {
+            CHECK(lfs_file_open(&fs.lfs, &f, name, LFS_O_WRONLY | LFS_O_CREAT | (op ? LFS_O_APPEND : LFS_O_TRUNC)) == 0);
+            CHECK(lfs_file_write(&fs.lfs, &f, data, len / (op ? 4 : 1)) == (lfs_ssize_t) (len / (op ? 4 : 1)));
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        } else if (op == 2 && lfs_file_open(&fs.lfs, &f, name, LFS_O_RDWR) == 0) {
+            CHECK(lfs_file_truncate(&fs.lfs, &f, len / 2) == 0);
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        } else if (op == 3 && lfs_file_open(&fs.lfs, &f, name, LFS_O_RDWR) == 0) {
+            lfs_soff_t pos = lfs_file_size(&fs.lfs, &f) ? len % lfs_file_size(&fs.lfs, &f) : 0;
+            CHECK(lfs_file_seek(&fs.lfs, &f, pos, LFS_SEEK_SET) == pos);
+            CHECK(lfs_file_write(&fs.lfs, &f, data, 100) == 100);
+            CHECK(lfs_file_seek(&fs.lfs, &f, pos / 2, LFS_SEEK_SET) == pos / 2);
+            CHECK(lfs_file_write(&fs.lfs, &f, data, 5000) == 5000);
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        } else if (op == 4) {
+            int err = lfs_remove(&fs.lfs, name);
+            CHECK(err == 0 || err == LFS_ERR_NOENT);
+        } else if (op == 5) {
+            sprintf(other, "f%d", rand() % 6);
+            int err = lfs_rename(&fs.lfs, name, other);
+            CHECK(err == 0 || err == LFS_ERR_NOENT);
+        } else if (op == 6) {
+            sprintf(other, "d%d", rand() % 3);
+            int err = lfs_mkdir(&fs.lfs, other);
+            if (err == LFS_ERR_EXIST) {
+                err = lfs_remove(&fs.lfs, other);
+            }
+            CHECK(err == 0);
+        } else if (op == 7 && lfs_file_open(&fs.lfs, &f, name, LFS_O_RDWR) == 0) {
+            // the same file written through two handles
+            CHECK(lfs_file_open(&fs.lfs, &g, name, LFS_O_RDWR | LFS_O_APPEND) == 0);
+            CHECK(lfs_file_write(&fs.lfs, &f, data, len) == (lfs_ssize_t) len);
+            CHECK(lfs_file_write(&fs.lfs, &g, data, 3000) == 3000);
+            CHECK(lfs_file_close(&fs.lfs, &g) == 0);
+            CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        }
+        if (step % 100 == 99) {
+            CHECK(lfs_unmount(&fs.lfs) == 0);
+            CHECK(lfs_mount(&fs.lfs, &fs.config) == 0);
+        }
+
+        CHECK(lfs_fs_size(&fs.lfs) == fresh_size());
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    chip->bad_len = 0;
+}
+
+/*
+ * Blocks erased by w25qxx_littlefs_pre_erase are the ones littlefs allocates
+ * next: writing a file takes them from the pool without erasing again
+ */
+static void test_pre_erase(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+    lfs_file_t f;
+    lfs_block_t next;
+
+    // nothing blank, so only the pool can save an erase
+    test_chip(&w25qxx, 0, 2 << 20);
+    memset(chip->mem, 0, TEST_BLOCKS * 4096);
+    test_mount(TEST_BLOCKS);
+
+    CHECK(lfs_fs_gc(&fs.lfs) == 0);
+    uint64_t erases = chip->erases;
+    while (w25qxx_littlefs_pre_erase(&fs) == 1) {
+    }
+    CHECK(fs.pool_count == W25QXX_LITTLEFS_POOL_SIZE);
+    CHECK(chip->erases - erases == W25QXX_LITTLEFS_POOL_SIZE);
+    CHECK(lfs_fs_next_free(&fs.lfs, 0, &next) == 0);
+    CHECK(next == fs.pool[0]);
+
+    erases = chip->erases;
+    uint32_t skipped = fs.erases_skipped;
+    CHECK(lfs_file_open(&fs.lfs, &f, "pre", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, data, 3 * 4096) == 3 * 4096);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(chip->erases == erases);
+    CHECK(fs.erases_skipped - skipped == W25QXX_LITTLEFS_POOL_SIZE - fs.pool_count);
+    CHECK(fs.pool_count < W25QXX_LITTLEFS_POOL_SIZE);
+    for (uint32_t i = 0; i < fs.pool_count; ++i) {
+        CHECK(fs.pool[i] != next);
+    }
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+
+#ifdef W25QXX_LITTLEFS_BLANK_CHECK
+/*
+ * Blocks that read back all 0xFF are not erased again, a block with a single
+ * programmed byte at its very end is
+ */
+static void test_blank_check(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+    lfs_file_t f;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount(TEST_BLOCKS);
+    uint64_t erases = chip->erases;
+    uint32_t skipped = fs.erases_skipped;
+    CHECK(lfs_file_open(&fs.lfs, &f, "blank", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, data, 3 * 4096) == 3 * 4096);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(chip->erases == erases);
+    CHECK(fs.erases_skipped - skipped >= 3);
+
+    for (uint32_t b = 0; b < TEST_BLOCKS; ++b) {
+        uint8_t *p = &chip->mem[b * 4096];
+        uint32_t i = 0;
+        while (i < 4096 && p[i] == 0xFF) {
+            ++i;
+        }
+        if (i == 4096) {
+            p[4095] = 0x7F;
+        }
+    }
+    erases = chip->erases;
+    skipped = fs.erases_skipped;
+    CHECK(lfs_file_open(&fs.lfs, &f, "dirty", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, data, 3 * 4096) == 3 * 4096);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(chip->erases - erases >= 3);
+    CHECK(fs.erases_skipped == skipped);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+#endif
+
+/*
+ * Mount a volume left by a build with W25QXX_LITTLEFS_FREEMAP the other way
+ * round (formatted with one block more or less), keeping its files, and
+ * refuse a volume of another size instead of reformatting it
+ */
+static void test_freemap_toggle(void) {
+    struct lfs_config cfg;
+    lfs_file_t f;
+#ifdef W25QXX_LITTLEFS_FREEMAP
+    const lfs_size_t other = TEST_BLOCKS;
+#else
+    const lfs_size_t other = TEST_BLOCKS - 1;
+#endif
+
+    for (int pass = 0; pass < 2; ++pass) {
+        test_chip(&w25qxx, 0, 2 << 20);
+        test_mount(TEST_BLOCKS);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+        cfg = fs.config;
+        cfg.block_count = pass ? TEST_BLOCKS - 2 : other;
+        cfg.freemap_buffer = NULL;
+        CHECK(lfs_format(&fs.lfs, &cfg) == 0);
+        CHECK(lfs_mount(&fs.lfs, &cfg) == 0);
+        CHECK(lfs_file_open(&fs.lfs, &f, "keep", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+        CHECK(lfs_file_write(&fs.lfs, &f, "kept", 4) == 4);
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+#ifndef W25QXX_LITTLEFS_FREEMAP
+        // a map saved by the other build, no longer right after our progs
+        memcpy(&flash_emu_chips[0].mem[(TEST_BLOCKS - 1) * 4096], "W2FM", 4);
+#endif
+
+        memset(&fs, 0, sizeof(fs));
+        fs.ram = (uint8_t *) ram;
+        fs.ram_size = sizeof(ram);
+        int err = w25qxx_littlefs_init(&fs, &w25qxx, 0, TEST_BLOCKS);
+        if (pass) {
+            CHECK(err == LFS_ERR_INVAL);
+            continue;
+        }
+        CHECK(err == 0);
+        CHECK(fs.lfs.block_count == other);
+        CHECK(lfs_file_open(&fs.lfs, &f, "keep", LFS_O_RDONLY) == 0);
+        CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == 4 && !memcmp(buf, "kept", 4));
+        CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+#ifdef W25QXX_LITTLEFS_FREEMAP
+        CHECK(w25qxx_littlefs_save_freemap(&fs) == LFS_ERR_INVAL);
+#else
+        uint32_t invalid;
+        memcpy(&invalid, &flash_emu_chips[0].mem[(TEST_BLOCKS - 1) * 4096 + 4], 4);
+        CHECK(invalid == 0);
+#endif
+        CHECK(lfs_unmount(&fs.lfs) == 0);
+    }
+}
+
+#ifdef W25QXX_LITTLEFS_FREEMAP
+/*
+ * The map runs out of free blocks and is rebuilt while a file holds blocks
+ * it has written but not committed: those must not be handed out again
+ */
+static void test_freemap_rebuild(void) {
+    lfs_file_t f, g;
+    int rebuilds = 0;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    test_mount(TEST_BLOCKS);
+    pattern(data, 9, 1, sizeof(data));
+    CHECK(lfs_file_open(&fs.lfs, &f, "open", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    for (int i = 0; i < 40; ++i) {
+        lfs_size_t free = fs.lfs.freemap.free;
+        if (i % 4 == 0) {
+            CHECK(lfs_file_write(&fs.lfs, &f, data + i / 4 * 1024, 1024) == 1024);
+        }
+        // churn through the map with rewrites of another file
+        CHECK(lfs_file_open(&fs.lfs, &g, "churn", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+        CHECK(lfs_file_write(&fs.lfs, &g, buf, 3 * 4096) == 3 * 4096);
+        CHECK(lfs_file_close(&fs.lfs, &g) == 0);
+        if (fs.lfs.freemap.valid && fs.lfs.freemap.free > free) {
+            ++rebuilds;
+        }
+    }
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(rebuilds > 0);
+
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+    test_mount(TEST_BLOCKS);
+    CHECK(lfs_file_open(&fs.lfs, &f, "open", LFS_O_RDONLY) == 0);
+    CHECK(lfs_file_read(&fs.lfs, &f, buf, sizeof(buf)) == 10 * 1024);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(!memcmp(buf, data, 10 * 1024));
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+#endif
+
+#ifdef W25QXX_LITTLEFS_STATS
+static uint32_t histogram_sum(const W25QXX_littlefs_op_stats_t *op) {
+    uint32_t sum = 0;
+    for (int i = 0; i < W25QXX_LITTLEFS_STATS_BUCKETS; ++i) {
+        sum += op->histogram[i];
+    }
+    return sum;
+}
+
+/*
+ * Block device calls with known sizes show up one for one in the counts
+ * and bytes, a file write adds at least its data to the prog bytes
+ */
+static void test_stats(void) {
+    static uint16_t block_erases[TEST_BLOCKS];
+    struct lfs_config *cfg = &fs.config;
+    lfs_block_t block;
+    lfs_file_t f;
+
+    test_chip(&w25qxx, 0, 2 << 20);
+    memset(&fs, 0, sizeof(fs));
+    fs.stats.block_erases = block_erases;
+    fs.stats.block_erases_len = TEST_BLOCKS;
+    CHECK(w25qxx_littlefs_init(&fs, &w25qxx, 0, TEST_BLOCKS) == 0);
+    CHECK(lfs_fs_gc(&fs.lfs) == 0);
+    CHECK(lfs_fs_next_free(&fs.lfs, 0, &block) == 0);
+
+    w25qxx_littlefs_reset_stats(&fs);
+    const W25QXX_littlefs_stats_t *stats = w25qxx_littlefs_get_stats(&fs);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(cfg->prog(cfg, block, i * 256, data, 256) == 0);
+    }
+    for (int i = 0; i < 5; ++i) {
+        CHECK(cfg->read(cfg, block, i * 100, buf, 100) == 0);
+    }
+    // the second erase finds the block blank
+    CHECK(cfg->erase(cfg, block) == 0);
+    CHECK(cfg->erase(cfg, block) == 0);
+    CHECK(cfg->sync(cfg) == 0);
+
+    CHECK(stats->prog.count == 3 && stats->prog.bytes == 768);
+    CHECK(stats->read.count == 5 && stats->read.bytes == 500);
+    CHECK(stats->erase.count == 2 && stats->erase.bytes == 2 * 4096);
+    CHECK(stats->sync.count == 1 && stats->sync.bytes == 0);
+    CHECK(histogram_sum(&stats->prog) == 3 && histogram_sum(&stats->read) == 5);
+    CHECK(stats->erase.time_min <= stats->erase.time_max);
+#ifdef W25QXX_LITTLEFS_BLANK_CHECK
+    CHECK(block_erases[block] == 1);
+#else
+    CHECK(block_erases[block] == 2);
+#endif
+
+    w25qxx_littlefs_reset_stats(&fs);
+    CHECK(stats->prog.count == 0 && block_erases[block] == 0);
+    CHECK(lfs_file_open(&fs.lfs, &f, "stats", LFS_O_WRONLY | LFS_O_CREAT) == 0);
+    CHECK(lfs_file_write(&fs.lfs, &f, data, 10000) == 10000);
+    CHECK(lfs_file_close(&fs.lfs, &f) == 0);
+    CHECK(stats->prog.bytes >= 10000 && stats->prog.bytes % cfg->prog_size == 0);
+    CHECK(stats->erase.count >= 3 && stats->sync.count > 0);
+    CHECK(lfs_unmount(&fs.lfs) == 0);
+}
+#endif
+
+int main(void) {
+    RUN(test_files);
+    RUN(test_bad_blocks);
+    RUN(test_split_dir);
+    RUN(test_power_loss);
+    RUN(test_full_volume);
+    RUN(test_used_blocks);
+    RUN(test_pre_erase);
+    RUN(test_freemap_toggle);
+#ifdef W25QXX_LITTLEFS_STATS
+    RUN(test_stats);
+#endif
+#ifdef W25QXX_LITTLEFS_FREEMAP
+    RUN(test_freemap_rebuild);
+#endif
+#ifdef W25QXX_LITTLEFS_BLANK_CHECK
+    RUN(test_blank_check);
+#endif
+    flash_emu_free();
+    return 0;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * @file           : test_partition.c
+ * @brief          : Host tests of the partition table and the record log
+ ******************************************************************************
+ */
+
+#include "test.h"
+#include "w25qxx_partition.h"
+
+#define LOG_OFFSET 0x10000
+#define LOG_SIZE 0x4000
+
+static W25QXX_HandleTypeDef w25qxx;
+static W25QXX_PartitionTableTypeDef table;
+static W25QXX_LogTypeDef log_;
+static uint8_t record[64];
+static uint8_t buf[64];
+
+/*
+ * Records carry their number in the first two bytes and a pattern after it
+ */
+static uint16_t make_record(uint16_t id) {
+    uint16_t len = 2 + id % 50;
+    memcpy(record, &id, sizeof(id));
+    for (uint16_t i = 2; i < len; ++i) {
+        record[i] = (uint8_t) (id * 7 + i);
+    }
+    return len;
+}
+
+static void append(uint16_t id) {
+    uint16_t len = make_record(id);
+    CHECK(w25qxx_log_append(&log_, record, len) == W25QXX_Ok);
+}
+
+typedef struct {
+    uint16_t first;
+    uint16_t next;
+} walk_t;
+
+static void walk_cb(W25QXX_LogTypeDef *log, const uint8_t *data, uint16_t len, void *context) {
+    walk_t *walk = context;
+    uint16_t id;
+
+    (void) log;
+    CHECK(len >= sizeof(id));
+    memcpy(&id, data, sizeof(id));
+    if (walk->next == 0xFFFF) {
+        walk->first = id;
+    } else {
+        CHECK(id == walk->next);
+    }
+    CHECK(len == make_record(id) && !memcmp(data, record, len));
+    walk->next = id + 1;
+}
+
+/*
+ * Walk the log and return the number of the record after the last one,
+ * checking the records run on without gaps
+ */
+static uint16_t walk(uint16_t *first) {
+    walk_t w = { 0, 0xFFFF };
+    CHECK(w25qxx_log_walk(&log_, buf, sizeof(buf), walk_cb, &w) == W25QXX_Ok);
+    if (first) {
+        *first = w.first;
+    }
+    return w.next == 0xFFFF ? 0 : w.next;
+}
+
+/*
+ * Open the log again, as after an MCU reset
+ */
+static void reopen(void) {
+    test_init(&w25qxx, 0);
+    CHECK(w25qxx_partition_load(&table, &w25qxx) == W25QXX_Ok);
+    CHECK(w25qxx_log_open(&log_, w25qxx_partition_find(&table, "log")) == W25QXX_Ok);
+}
+
+static void test_log_chip(void) {
+    static const W25QXX_partition_entry_t entries[] = {
+        { "log", W25QXX_PARTITION_LOG, LOG_OFFSET, LOG_SIZE },
+    };
+
+    test_chip(&w25qxx, 0, 1 << 20);
+    CHECK(w25qxx_partition_create(&table, &w25qxx, entries, 1) == W25QXX_Ok);
+    CHECK(w25qxx_log_open(&log_, w25qxx_partition_find(&table, "log")) == W25QXX_Ok);
+}
+
+static void test_log_append(void) {
+    uint16_t first;
+
+    test_log_chip();
+    CHECK(walk(NULL) == 0);
+    for (uint16_t id = 0; id < 40; ++id) {
+        append(id);
+    }
+    CHECK(walk(&first) == 40 && first == 0);
+    reopen();
+    CHECK(walk(&first) == 40 && first == 0);
+
+    // Wrapping around drops the oldest sector
+    for (uint16_t id = 40; id < 600; ++id) {
+        append(id);
+    }
+    CHECK(walk(&first) == 600 && first > 0);
+    reopen();
+    CHECK(walk(&first) == 600 && first > 0);
+    append(600);
+    CHECK(walk(NULL) == 601);
+}
+
+/*
+ * A damaged record ends the walk, and appends carry on after it
+ */
+static void test_log_damage(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+    uint16_t first;
+
+    test_log_chip();
+    for (uint16_t id = 0; id < 10; ++id) {
+        append(id);
+    }
+
+    // Clear a bit in the payload of record 5, as a program cut short can
+    uint32_t pos = LOG_OFFSET + 8;
+    for (uint16_t id = 0; id < 5; ++id) {
+        pos += 6 + make_record(id);
+    }
+    chip->mem[pos + 6 + 3] &= chip->mem[pos + 6 + 3] - 1;
+
+    reopen();
+    CHECK(walk(&first) == 5 && first == 0);
+    append(5);
+    CHECK(walk(&first) == 6 && first == 0);
+    reopen();
+    CHECK(walk(&first) == 6 && first == 0);
+}
+
+/*
+ * Cut the power at every program and erase of a run of appends, the log
+ * must come back with the records before the cut and take new ones
+ */
+static void test_log_power_loss(void) {
+    static uint8_t image[1 << 20];
+    flash_emu_t *chip = &flash_emu_chips[0];
+    jmp_buf env;
+
+    test_log_chip();
+    for (uint16_t id = 0; id < 50; ++id) {
+        append(id);
+    }
+    memcpy(image, chip->mem, sizeof(image));
+
+    uint32_t ops = flash_emu_power_ops();
+    for (uint16_t id = 50; id < 100; ++id) {
+        append(id);
+    }
+    ops = flash_emu_power_ops() - ops;
+
+    for (uint32_t cut = 0; cut < ops; ++cut) {
+        memcpy(chip->mem, image, sizeof(image));
+        flash_emu_power_on();
+        reopen();
+        if (!setjmp(env)) {
+            flash_emu_power_cut(cut, &env);
+            for (uint16_t id = 50; id < 100; ++id) {
+                append(id);
+            }
+            flash_emu_power_cut(0, NULL);
+        }
+        flash_emu_power_on();
+        reopen();
+
+        uint16_t first;
+        uint16_t next = walk(&first);
+        CHECK(first == 0 && next >= 50 && next < 100);
+        append(next);
+        CHECK(walk(&first) == next + 1 && first == 0);
+        reopen();
+        CHECK(walk(&first) == next + 1 && first == 0);
+    }
+}
+
+int main(void) {
+    RUN(test_log_append);
+    RUN(test_log_damage);
+    RUN(test_log_power_loss);
+    flash_emu_free();
+    return 0;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,196 @@
+/**
+ ******************************************************************************
+ * @file           : test_w25qxx.c
+ * @brief          : Host tests of the W25Qxx driver
+ ******************************************************************************
+ */
+
+#include "test.h"
+
+static W25QXX_HandleTypeDef w25qxx;
+static uint8_t data[9000];
+static uint8_t buf[9000];
+
+static void test_sfdp(void) {
+    test_chip(&w25qxx, 0, 16 << 20);
+    CHECK(w25qxx.manufacturer_id == 0xEF && w25qxx.device_id == 0x4018);
+    CHECK(w25qxx.block_count == 256 && w25qxx.block_size == 0x10000);
+    CHECK(w25qxx.sector_size == 0x1000 && w25qxx.page_size == 0x100);
+    CHECK(w25qxx.dual_read_instruction == 0x3B && w25qxx.quad_read_instruction == 0x6B);
+    CHECK(!w25qxx.address_4byte);
+
+    // Above 16 MB the part is switched to 4 byte addresses
+    test_chip(&w25qxx, 1, 32 << 20);
+    CHECK(w25qxx.block_count == 512 && w25qxx.address_4byte && flash_emu_chips[1].addr4);
+}
+
+static void test_read_write(W25QXX_read_mode_t mode, uint32_t address) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+
+    CHECK(w25qxx_set_read_mode(&w25qxx, mode) == W25QXX_Ok);
+    CHECK(w25qxx_erase(&w25qxx, address, 3 * 4096) == W25QXX_Ok);
+    CHECK(w25qxx_write(&w25qxx, address + 17, data, sizeof(data)) == W25QXX_Ok);
+    CHECK(w25qxx_read(&w25qxx, address + 17, buf, sizeof(buf)) == W25QXX_Ok);
+    CHECK(!memcmp(buf, data, sizeof(data)));
+    CHECK(!memcmp(chip->mem + address + 17, data, sizeof(data)));
+    CHECK(chip->busy_violations == 0 && chip->line_violations == 0);
+}
+
+static void test_read_modes(void) {
+    for (uint32_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t) rand();
+    }
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    test_read_write(W25QXX_READ_NORMAL, 0x3000);
+    CHECK(flash_emu_chips[0].commands[0x03] > 0);
+    test_read_write(W25QXX_READ_FAST, 0x6000);
+    CHECK(flash_emu_chips[0].commands[0x0B] > 0);
+#ifdef W25QXX_QSPI
+    test_read_write(W25QXX_READ_DUAL_OUT, 0x9000);
+    CHECK(flash_emu_chips[0].commands[0x3B] > 0);
+    test_read_write(W25QXX_READ_QUAD_OUT, 0xC000);
+    CHECK(flash_emu_chips[0].commands[0x6B] > 0 && flash_emu_chips[0].qe);
+#else
+    CHECK(w25qxx_set_read_mode(&w25qxx, W25QXX_READ_DUAL_OUT) == W25QXX_Err);
+    CHECK(w25qxx_set_read_mode(&w25qxx, W25QXX_READ_QUAD_OUT) == W25QXX_Err);
+#endif
+
+    // 4 byte addresses above 16 MB
+    test_chip(&w25qxx, 0, 32 << 20);
+    test_read_write(W25QXX_READ_FAST, 0x1003000);
+}
+
+static void test_blank_pages(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    memset(buf, 0xFF, 1024);
+    buf[300] = 0x12;
+    buf[301] = 0x34;
+    CHECK(w25qxx_erase(&w25qxx, 0, 4096) == W25QXX_Ok);
+    CHECK(w25qxx_write(&w25qxx, 0, buf, 1024) == W25QXX_Ok);
+    CHECK(chip->programs == 1 && chip->program_bytes == 2);
+    CHECK(chip->mem[300] == 0x12 && chip->mem[301] == 0x34 && chip->mem[299] == 0xFF);
+}
+
+static void test_erase_units(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    memset(chip->mem, 0, chip->size);
+    // Sector, 32 KB and 64 KB erases for an unaligned range
+    CHECK(w25qxx_erase(&w25qxx, 0x7000, 0x20000) == W25QXX_Ok);
+    flash_emu_advance(FLASH_EMU_BLOCK64_ERASE_US);
+    CHECK(chip->commands[0x20] == 8 && chip->commands[0x52] == 1 && chip->commands[0xD8] == 1);
+    CHECK(chip->mem[0x6FFF] == 0x00 && chip->mem[0x7000] == 0xFF);
+    CHECK(chip->mem[0x26FFF] == 0xFF && chip->mem[0x27000] == 0x00);
+}
+
+static void test_suspend(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    CHECK(w25qxx_write(&w25qxx, 0x20000, data, 256) == W25QXX_Ok);
+    CHECK(w25qxx_erase(&w25qxx, 0x40000, 4096) == W25QXX_Ok);
+
+    // A read elsewhere suspends the erase instead of waiting for it
+    uint64_t start = flash_emu_now;
+    CHECK(w25qxx_read(&w25qxx, 0x20000, buf, 256) == W25QXX_Ok);
+    CHECK(!memcmp(buf, data, 256));
+    CHECK(flash_emu_now - start < 1000);
+    CHECK(chip->commands[0x75] == 1 && chip->commands[0x7A] == 1);
+
+    // A read of the area being erased waits for it
+    CHECK(w25qxx_read(&w25qxx, 0x40000, buf, 256) == W25QXX_Ok);
+    CHECK(chip->commands[0x75] == 1);
+    CHECK(buf[0] == 0xFF && chip->busy_violations == 0);
+}
+
+#ifdef W25QXX_DMA
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    w25qxx_spi_dma_complete(hspi);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    w25qxx_spi_dma_complete(hspi);
+}
+
+static uint32_t yields;
+
+static void test_yield(W25QXX_HandleTypeDef *handle) {
+    (void) handle;
+    ++yields;
+}
+
+/*
+ * Long data phases go through DMA, and a lost completion callback ends in a
+ * timeout instead of a hang
+ */
+static void test_dma(void) {
+    flash_emu_t *chip = &flash_emu_chips[0];
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    w25qxx.yield = test_yield;
+    test_read_write(W25QXX_READ_FAST, 0x3000);
+    CHECK(chip->dma_transfers > 0 && yields > 0);
+
+    flash_emu_dma_lost = 1;
+    uint64_t start = flash_emu_now;
+    CHECK(w25qxx_read(&w25qxx, 0x3000, buf, 1024) == W25QXX_Timeout);
+    CHECK(flash_emu_now - start > W25QXX_DMA_TIMEOUT * 1000);
+    flash_emu_dma_lost = 0;
+
+    // The driver recovers once the callbacks come back
+    CHECK(w25qxx_read(&w25qxx, 0x3000 + 17, buf, sizeof(buf)) == W25QXX_Ok);
+    CHECK(!memcmp(buf, data, sizeof(buf)));
+}
+
+/*
+ * Two chips on the same SPI handle each get the completion of their own
+ * transfers, and w25qxx_init refuses more handles than the callbacks search
+ */
+static void test_dma_handles(void) {
+    static W25QXX_HandleTypeDef other, extra[W25QXX_DMA_HANDLES];
+
+    test_chip(&w25qxx, 0, 16 << 20);
+    test_chip(&other, 1, 16 << 20);
+    CHECK(w25qxx_write(&w25qxx, 0x1000, data, 4096) == W25QXX_Ok);
+    CHECK(w25qxx_write(&other, 0x1000, data + 100, 4096) == W25QXX_Ok);
+    for (int i = 0; i < 4; ++i) {
+        W25QXX_HandleTypeDef *handle = i % 2 ? &other : &w25qxx;
+        CHECK(w25qxx_read(handle, 0x1000, buf, 4096) == W25QXX_Ok);
+        CHECK(!memcmp(buf, data + (i % 2 ? 100 : 0), 4096));
+        CHECK(!handle->dma_busy);
+    }
+
+    flash_emu_init(2, 1 << 20, 0xEF4018);
+    flash_emu_sfdp(2);
+    int registered = 0;
+    for (int i = 0; i < W25QXX_DMA_HANDLES; ++i) {
+        if (w25qxx_init(&extra[i], &test_spi, &test_port[2], GPIO_PIN_4) == W25QXX_Ok) {
+            ++registered;
+        }
+    }
+    CHECK(registered == W25QXX_DMA_HANDLES - 2);
+    CHECK(extra[W25QXX_DMA_HANDLES - 1].spiHandle == NULL);
+}
+#endif
+
+int main(void) {
+    RUN(test_sfdp);
+    RUN(test_read_modes);
+    RUN(test_blank_pages);
+    RUN(test_erase_units);
+    RUN(test_suspend);
+#ifdef W25QXX_DMA
+    RUN(test_dma);
+    RUN(test_dma_handles);
+#endif
+    flash_emu_free();
+    return 0;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -40,6 +40,8 @@
 static inline void cs_on(W25QXX_HandleTypeDef *w25qxx) {
 #ifndef W25QXX_QSPI
     HAL_GPIO_WritePin(w25qxx->cs_port, w25qxx->cs_pin, GPIO_PIN_RESET);
+#else
+    (void) w25qxx;
 #endif
 }
 
@@ -50,9 +52,149 @@ static inline void cs_on(W25QXX_HandleTypeDef *w25qxx) {
  * @retval None
  */
 static inline void cs_off(W25QXX_HandleTypeDef *w25qxx) {
+#ifndef W25QXX_QSPI
     HAL_GPIO_WritePin(w25qxx->cs_port, w25qxx->cs_pin, GPIO_PIN_SET);
+#else
+    (void) w25qxx;
+#endif
+}
+
+/**
+ * @brief  Number of address bytes used for array commands
+ *
+ * @param  W25Qxx handle
+ * @retval 3 or 4
+ */
+static inline uint8_t address_len(W25QXX_HandleTypeDef *w25qxx) {
+    return w25qxx->address_4byte ? 4 : 3;
+}
+
+/**
+ * @brief  Call the yield hook (if any) while waiting
+ *
+ * @param  W25Qxx handle
+ * @retval None
+ */
+static inline void w25qxx_yield(W25QXX_HandleTypeDef *w25qxx) {
+    if (w25qxx->yield) {
+        w25qxx->yield(w25qxx);
+    }
+}
+
+#ifndef W25QXX_QSPI
+
+#ifdef W25QXX_DMA
+
+// Handles the completion callbacks search for the transfer of their SPI handle
+static W25QXX_HandleTypeDef *dma_handles[W25QXX_DMA_HANDLES];
+
+/**
+ * @brief  Add a handle to the ones the DMA callbacks search
+ *
+ * @param  W25Qxx handle
+ * @retval W25QXX_Ok, W25QXX_Err if W25QXX_DMA_HANDLES are already registered
+ */
+static W25QXX_result_t dma_register(W25QXX_HandleTypeDef *w25qxx) {
+    w25qxx->dma_busy = 0;
+    for (uint32_t i = 0; i < W25QXX_DMA_HANDLES; ++i) {
+        if (dma_handles[i] == w25qxx) {
+            return W25QXX_Ok;
+        }
+    }
+    for (uint32_t i = 0; i < W25QXX_DMA_HANDLES; ++i) {
+        if (!dma_handles[i]) {
+            dma_handles[i] = w25qxx;
+            return W25QXX_Ok;
+        }
+    }
+    W25_DBG("No room for another DMA handle");
+    return W25QXX_Err;
+}
+
+static void dma_done(SPI_HandleTypeDef *hspi, W25QXX_result_t result) {
+    for (uint32_t i = 0; i < W25QXX_DMA_HANDLES; ++i) {
+        W25QXX_HandleTypeDef *w25qxx = dma_handles[i];
+        if (w25qxx && w25qxx->dma_busy && w25qxx->spiHandle == hspi) {
+            w25qxx->dma_result = result;
+            w25qxx->dma_busy = 0;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief  Report a finished DMA transfer, call it from the application's
+ *         HAL_SPI_TxCpltCallback, HAL_SPI_RxCpltCallback and
+ *         HAL_SPI_TxRxCpltCallback
+ *
+ * @param  SPI handle passed to the callback, transfers on other handles are ignored
+ * @retval None
+ */
+void w25qxx_spi_dma_complete(SPI_HandleTypeDef *hspi) {
+    dma_done(hspi, W25QXX_Ok);
+}
+
+/**
+ * @brief  Report a failed DMA transfer, call it from the application's
+ *         HAL_SPI_ErrorCallback
+ *
+ * @param  SPI handle passed to the callback, transfers on other handles are ignored
+ * @retval None
+ */
+void w25qxx_spi_dma_error(SPI_HandleTypeDef *hspi) {
+    dma_done(hspi, W25QXX_Err);
 }
 
+/**
+ * @brief  Move a data phase with DMA and wait for the completion callback
+ *
+ * HAL transfers are limited to 16 bit lengths so longer buffers are split.
+ * The wait yields and gives up, aborting the transfer, when no callback
+ * arrives within W25QXX_DMA_TIMEOUT ticks.
+ *
+ * @param  W25Qxx handle
+ * @param  Pointer to buffer
+ * @param  Length (in bytes)
+ * @param  Non-zero to receive, zero to transmit
+ * @retval W25QXX_Ok on success, W25QXX_Timeout if a callback never came
+ */
+static W25QXX_result_t w25qxx_dma(W25QXX_HandleTypeDef *w25qxx, uint8_t *buf, uint32_t len, uint8_t receive) {
+    while (len) {
+        uint16_t chunk = len > 0xFFFF ? 0xFFFF : (uint16_t) len;
+        HAL_StatusTypeDef status;
+
+        w25qxx->dma_result = W25QXX_Err;
+        w25qxx->dma_busy = 1;
+        if (receive) {
+            status = HAL_SPI_Receive_DMA(w25qxx->spiHandle, buf, chunk);
+        } else {
+            status = HAL_SPI_Transmit_DMA(w25qxx->spiHandle, buf, chunk);
+        }
+        if (status != HAL_OK) {
+            w25qxx->dma_busy = 0;
+            return W25QXX_Err;
+        }
+        uint32_t begin = HAL_GetTick();
+        while (w25qxx->dma_busy) {
+            if (HAL_GetTick() - begin > W25QXX_DMA_TIMEOUT) {
+                HAL_SPI_Abort(w25qxx->spiHandle);
+                w25qxx->dma_busy = 0;
+                return W25QXX_Timeout;
+            }
+            w25qxx_yield(w25qxx);
+        }
+        if (w25qxx->dma_result != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+
+        buf += chunk;
+        len -= chunk;
+    }
+    return W25QXX_Ok;
+}
+
+#endif
+
 /**
  * @brief  Transmit data to w25qxx - ignore returned data
  *
@@ -63,6 +205,11 @@ static inline void cs_off(W25QXX_HandleTypeDef *w25qxx) {
  */
 W25QXX_result_t w25qxx_transmit(W25QXX_HandleTypeDef *w25qxx, uint8_t *buf, uint32_t len) {
     W25QXX_result_t ret = W25QXX_Err;
+#ifdef W25QXX_DMA
+    if (len >= W25QXX_DMA_THRESHOLD) {
+        return w25qxx_dma(w25qxx, buf, len, 0);
+    }
+#endif
     if (HAL_SPI_Transmit(w25qxx->spiHandle, buf, len, HAL_MAX_DELAY) == HAL_OK) {
         ret = W25QXX_Ok;
     }
@@ -74,62 +221,558 @@ W25QXX_result_t w25qxx_transmit(W25QXX_HandleTypeDef *w25qxx, uint8_t *buf, uint
  */
 W25QXX_result_t w25qxx_receive(W25QXX_HandleTypeDef *w25qxx, uint8_t *buf, uint32_t len) {
     W25QXX_result_t ret = W25QXX_Err;
+#ifdef W25QXX_DMA
+    if (len >= W25QXX_DMA_THRESHOLD) {
+        return w25qxx_dma(w25qxx, buf, len, 1);
+    }
+#endif
     if (HAL_SPI_Receive(w25qxx->spiHandle, buf, len, HAL_MAX_DELAY) == HAL_OK) {
         ret = W25QXX_Ok;
     }
     return ret;
 }
 
-uint32_t w25qxx_read_id(W25QXX_HandleTypeDef *w25qxx) {
-    uint32_t ret = 0;
-    uint8_t buf[3];
+/**
+ * @brief  Run a list of segments as one transaction under a single CS assertion
+ *
+ * Small transactions are packed into one full duplex HAL call, larger ones
+ * are run segment by segment (with DMA if enabled).
+ *
+ * @param  W25Qxx handle
+ * @param  Array of segments
+ * @param  Number of segments
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_xfer(W25QXX_HandleTypeDef *w25qxx, const W25QXX_segment_t *segments, uint32_t count) {
+
+    W25QXX_result_t ret = W25QXX_Ok;
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        total += segments[i].len;
+    }
+
     cs_on(w25qxx);
-    buf[0] = W25QXX_GET_ID;
-    if (w25qxx_transmit(w25qxx, buf, 1) == W25QXX_Ok) {
-        if (w25qxx_receive(w25qxx, buf, 3) == W25QXX_Ok) {
-            ret = (uint32_t) ((buf[0] << 16) | (buf[1] << 8) | (buf[2]));
+
+    if (total <= W25QXX_XFER_PACK_SIZE) {
+
+        uint8_t tx[W25QXX_XFER_PACK_SIZE];
+        uint8_t rx[W25QXX_XFER_PACK_SIZE];
+        uint32_t pos = 0;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            if (segments[i].tx) {
+                memcpy(tx + pos, segments[i].tx, segments[i].len);
+            } else {
+                memset(tx + pos, W25QXX_DUMMY_BYTE, segments[i].len);
+            }
+            pos += segments[i].len;
+        }
+
+        if (HAL_SPI_TransmitReceive(w25qxx->spiHandle, tx, rx, total, HAL_MAX_DELAY) != HAL_OK) {
+            ret = W25QXX_Err;
         }
+
+        pos = 0;
+        for (uint32_t i = 0; i < count && ret == W25QXX_Ok; ++i) {
+            if (segments[i].rx) {
+                memcpy(segments[i].rx, rx + pos, segments[i].len);
+            }
+            pos += segments[i].len;
+        }
+
+    } else {
+
+        for (uint32_t i = 0; i < count && ret == W25QXX_Ok; ++i) {
+            const W25QXX_segment_t *seg = &segments[i];
+            if (!seg->len) {
+                continue;
+            }
+            if (seg->tx && seg->rx) {
+                if (HAL_SPI_TransmitReceive(w25qxx->spiHandle, (uint8_t *) seg->tx, seg->rx, seg->len, HAL_MAX_DELAY) != HAL_OK) {
+                    ret = W25QXX_Err;
+                }
+            } else if (seg->rx) {
+                ret = w25qxx_receive(w25qxx, seg->rx, seg->len);
+            } else if (seg->tx) {
+                ret = w25qxx_transmit(w25qxx, (uint8_t *) seg->tx, seg->len);
+            } else {
+                // Clock out dummy bytes and discard
+                uint8_t dummy[4] = { W25QXX_DUMMY_BYTE, W25QXX_DUMMY_BYTE, W25QXX_DUMMY_BYTE, W25QXX_DUMMY_BYTE };
+                for (uint32_t left = seg->len; left && ret == W25QXX_Ok;) {
+                    uint32_t chunk = left > sizeof(dummy) ? sizeof(dummy) : left;
+                    ret = w25qxx_transmit(w25qxx, dummy, chunk);
+                    left -= chunk;
+                }
+            }
+        }
+
     }
+
     cs_off(w25qxx);
+
+    return ret;
+}
+
+#endif
+
+/**
+ * @brief  Run one complete command (instruction, address, dummy and data phase)
+ *
+ * On plain SPI the header is clocked out in one transmit followed by the data
+ * phase within a single CS window.  On QSPI the whole command is handed to the
+ * peripheral which also takes care of CS and the number of data lines.
+ *
+ * @param  W25Qxx handle
+ * @param  Instruction (opcode)
+ * @param  Address
+ * @param  Number of address bytes (0 if the command takes no address)
+ * @param  Number of dummy clocks between address and data
+ * @param  Number of data lines (1, 2 or 4 - only 1 on plain SPI)
+ * @param  Data buffer (may be NULL if len is 0)
+ * @param  Length of data phase
+ * @param  Non-zero to receive the data phase, zero to transmit it
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_command(W25QXX_HandleTypeDef *w25qxx, uint8_t instruction, uint32_t address, uint8_t address_len,
+        uint8_t dummy_cycles, uint8_t data_lines, uint8_t *buf, uint32_t len, uint8_t receive) {
+
+    W25_STAT(w25qxx, transactions);
+
+#ifdef W25QXX_QSPI
+
+    QSPI_CommandTypeDef cmd = { 0 };
+
+    cmd.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    cmd.Instruction = instruction;
+    cmd.AddressMode = address_len ? QSPI_ADDRESS_1_LINE : QSPI_ADDRESS_NONE;
+    cmd.AddressSize = address_len == 4 ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS;
+    cmd.Address = address;
+    cmd.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    cmd.DummyCycles = dummy_cycles;
+    cmd.DataMode = len == 0 ? QSPI_DATA_NONE : data_lines == 4 ? QSPI_DATA_4_LINES : data_lines == 2 ? QSPI_DATA_2_LINES : QSPI_DATA_1_LINE;
+    cmd.NbData = len;
+    cmd.DdrMode = QSPI_DDR_MODE_DISABLE;
+    cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    if (HAL_QSPI_Command(w25qxx->qspiHandle, &cmd, HAL_MAX_DELAY) != HAL_OK) {
+        return W25QXX_Err;
+    }
+
+    if (len) {
+        if (receive) {
+            if (HAL_QSPI_Receive(w25qxx->qspiHandle, buf, HAL_MAX_DELAY) != HAL_OK) {
+                return W25QXX_Err;
+            }
+        } else {
+            if (HAL_QSPI_Transmit(w25qxx->qspiHandle, buf, HAL_MAX_DELAY) != HAL_OK) {
+                return W25QXX_Err;
+            }
+        }
+    }
+
+    return W25QXX_Ok;
+
+#else
+
+    // Plain SPI only has a single data line and dummy clocks come in whole bytes
+    if (data_lines != 1 || (dummy_cycles & 0x07) || dummy_cycles > 32) {
+        return W25QXX_Err;
+    }
+
+    uint8_t tx[1 + 4 + 4];
+    uint32_t tx_len = 0;
+
+    tx[tx_len++] = instruction;
+    for (uint8_t i = address_len; i > 0; --i) {
+        tx[tx_len++] = (uint8_t) (address >> (8 * (i - 1)));
+    }
+    for (uint8_t i = 0; i < dummy_cycles / 8; ++i) {
+        tx[tx_len++] = W25QXX_DUMMY_BYTE;
+    }
+
+    W25QXX_segment_t segments[2] = {
+            { tx, NULL, tx_len },
+            { receive ? NULL : buf, receive ? buf : NULL, len }
+    };
+
+    return w25qxx_xfer(w25qxx, segments, len ? 2 : 1);
+
+#endif
+
+}
+
+uint32_t w25qxx_read_id(W25QXX_HandleTypeDef *w25qxx) {
+    uint32_t ret = 0;
+    uint8_t buf[3];
+    if (w25qxx_command(w25qxx, W25QXX_GET_ID, 0, 0, 0, 1, buf, 3, 1) == W25QXX_Ok) {
+        ret = (uint32_t) ((buf[0] << 16) | (buf[1] << 8) | (buf[2]));
+    }
     return ret;
 }
 
 uint8_t w25qxx_get_status(W25QXX_HandleTypeDef *w25qxx) {
     uint8_t ret = 0;
-    uint8_t buf = W25QXX_READ_REGISTER_1;
-    cs_on(w25qxx);
-    if (w25qxx_transmit(w25qxx, &buf, 1) == W25QXX_Ok) {
-        if (w25qxx_receive(w25qxx, &buf, 1) == W25QXX_Ok) {
-            ret = buf;
-        }
+    uint8_t buf;
+    W25_STAT(w25qxx, status_polls);
+    if (w25qxx_command(w25qxx, W25QXX_READ_REGISTER_1, 0, 0, 0, 1, &buf, 1, 1) == W25QXX_Ok) {
+        ret = buf;
     }
-    cs_off(w25qxx);
     return ret;
 }
 
 W25QXX_result_t w25qxx_write_enable(W25QXX_HandleTypeDef *w25qxx) {
     W25_DBG("w25qxx_write_enable");
-    W25QXX_result_t ret = W25QXX_Err;
-    uint8_t buf[1];
-    cs_on(w25qxx);
-    buf[0] = W25QXX_WRITE_ENABLE;
-    if (w25qxx_transmit(w25qxx, buf, 1) == W25QXX_Ok) {
-        ret = W25QXX_Ok;
-    }
-    cs_off(w25qxx);
-    return ret;
+    return w25qxx_command(w25qxx, W25QXX_WRITE_ENABLE, 0, 0, 0, 1, NULL, 0, 0);
 }
 
 W25QXX_result_t w25qxx_wait_for_ready(W25QXX_HandleTypeDef *w25qxx, uint32_t timeout) {
-    W25QXX_result_t ret = W25QXX_Ok;
     uint32_t begin = HAL_GetTick();
-    uint32_t now = HAL_GetTick();
-    while ((now - begin <= timeout) && (w25qxx_get_status(w25qxx))) {
-        now = HAL_GetTick();
+    while (w25qxx_get_status(w25qxx) & W25QXX_STATUS_1_BUSY) {
+        if (HAL_GetTick() - begin > timeout) {
+            return W25QXX_Timeout;
+        }
     }
-    if (now - begin == timeout)
-        ret = W25QXX_Timeout;
-    return ret;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Remember a program/erase left running in the device
+ *
+ * @param  W25Qxx handle
+ * @param  Operation
+ * @param  Start address of the area being changed
+ * @param  Length of the area being changed
+ * @retval None
+ */
+static inline void w25qxx_set_pending(W25QXX_HandleTypeDef *w25qxx, W25QXX_op_t op, uint32_t address, uint32_t len) {
+    w25qxx->pending_op = op;
+    w25qxx->pending_address = address;
+    w25qxx->pending_len = len;
+    w25qxx->pending_tick = HAL_GetTick();
+}
+
+/**
+ * @brief  Typical and maximum duration of the pending operation
+ *
+ * @param  W25Qxx handle
+ * @param  Returns typical time in ticks
+ * @param  Returns maximum time in ticks
+ * @retval None
+ */
+static void w25qxx_pending_time(W25QXX_HandleTypeDef *w25qxx, uint32_t *typical, uint32_t *max) {
+    uint32_t blocks = w25qxx->pending_len / W25QXX_BLOCK_64K_SIZE;
+
+    switch (w25qxx->pending_op) {
+    case W25QXX_OP_PROGRAM:
+        *typical = W25QXX_PAGE_PROGRAM_TIME;
+        *max = W25QXX_PAGE_PROGRAM_TIME_MAX;
+        break;
+    case W25QXX_OP_ERASE:
+    case W25QXX_OP_CHIP_ERASE:
+        if (w25qxx->pending_len <= 0x1000) {
+            *typical = W25QXX_SECTOR_ERASE_TIME;
+            *max = W25QXX_SECTOR_ERASE_TIME_MAX;
+        } else if (w25qxx->pending_len <= 0x8000) {
+            *typical = W25QXX_BLOCK32_ERASE_TIME;
+            *max = W25QXX_BLOCK32_ERASE_TIME_MAX;
+        } else {
+            *typical = W25QXX_BLOCK64_ERASE_TIME * (blocks ? blocks : 1);
+            *max = W25QXX_BLOCK64_ERASE_TIME_MAX * (blocks ? blocks : 1);
+        }
+        break;
+    default:
+        *typical = 0;
+        *max = HAL_MAX_DELAY;
+    }
+}
+
+/**
+ * @brief  Wait for any pending program/erase to finish
+ *
+ * The status register is not polled before the operation's typical time has
+ * passed, after that polls back off up to W25QXX_POLL_INTERVAL_MAX ticks apart.
+ *
+ * @param  W25Qxx handle
+ * @retval W25QXX_Ok when the device is idle, W25QXX_Timeout if the maximum time passed
+ */
+static W25QXX_result_t w25qxx_wait_for_idle(W25QXX_HandleTypeDef *w25qxx) {
+    if (w25qxx->pending_op == W25QXX_OP_NONE) {
+        W25_STAT(w25qxx, polls_skipped);
+        return W25QXX_Ok;
+    }
+
+    uint32_t typical;
+    uint32_t max;
+    w25qxx_pending_time(w25qxx, &typical, &max);
+
+    while (HAL_GetTick() - w25qxx->pending_tick < typical) {
+        w25qxx_yield(w25qxx);
+    }
+
+    uint32_t interval = 0;
+    while (w25qxx_get_status(w25qxx) & W25QXX_STATUS_1_BUSY) {
+        uint32_t now = HAL_GetTick();
+        if (now - w25qxx->pending_tick > max) {
+            W25_DBG("w25qxx_wait_for_idle: timeout");
+            return W25QXX_Timeout;
+        }
+        do {
+            w25qxx_yield(w25qxx);
+        } while (HAL_GetTick() - now < interval);
+        interval = interval * 2 + 1 < W25QXX_POLL_INTERVAL_MAX ? interval * 2 + 1 : W25QXX_POLL_INTERVAL_MAX;
+    }
+
+    w25qxx->pending_op = W25QXX_OP_NONE;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Suspend a pending program/erase so a read can be served
+ *
+ * Only done if the read does not touch the area being programmed/erased and
+ * the operation was not resumed too recently to make progress.
+ *
+ * @param  W25Qxx handle
+ * @param  Address of the read
+ * @param  Length of the read
+ * @retval 1 if the operation was suspended and must be resumed, 0 otherwise
+ */
+static uint8_t w25qxx_suspend(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint32_t len) {
+
+    if (w25qxx->pending_op != W25QXX_OP_PROGRAM && w25qxx->pending_op != W25QXX_OP_ERASE) {
+        return 0;
+    }
+
+    if (address < w25qxx->pending_address + w25qxx->pending_len && address + len > w25qxx->pending_address) {
+        return 0;
+    }
+
+    if (HAL_GetTick() - w25qxx->resume_tick < W25QXX_SUSPEND_INTERVAL) {
+        return 0;
+    }
+
+    if (!(w25qxx_get_status(w25qxx) & W25QXX_STATUS_1_BUSY)) {
+        w25qxx->pending_op = W25QXX_OP_NONE;
+        return 0;
+    }
+
+    W25_DBG("w25qxx_suspend: address 0x%08" PRIx32, w25qxx->pending_address);
+
+    if (w25qxx_command(w25qxx, W25QXX_SUSPEND, 0, 0, 0, 1, NULL, 0, 0) != W25QXX_Ok) {
+        return 0;
+    }
+
+    // BUSY clears once the device has entered the suspended state (tSUS)
+    if (w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY) != W25QXX_Ok) {
+        w25qxx_command(w25qxx, W25QXX_RESUME, 0, 0, 0, 1, NULL, 0, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Resume a program/erase suspended by w25qxx_suspend
+ *
+ * @param  W25Qxx handle
+ * @param  HAL tick when the operation was suspended
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_resume(W25QXX_HandleTypeDef *w25qxx, uint32_t suspend_tick) {
+    W25_DBG("w25qxx_resume");
+    w25qxx->resume_tick = HAL_GetTick();
+    // The operation made no progress while suspended
+    w25qxx->pending_tick += w25qxx->resume_tick - suspend_tick;
+    return w25qxx_command(w25qxx, W25QXX_RESUME, 0, 0, 0, 1, NULL, 0, 0);
+}
+
+#ifdef W25QXX_QSPI
+/**
+ * @brief  Set the Quad Enable bit in status register 2 (needed for 0x6B)
+ *
+ * @param  W25Qxx handle
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_quad_enable(W25QXX_HandleTypeDef *w25qxx) {
+    uint8_t status;
+    if (w25qxx_command(w25qxx, W25QXX_READ_REGISTER_2, 0, 0, 0, 1, &status, 1, 1) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    if (status & W25QXX_STATUS_2_QE) {
+        return W25QXX_Ok;
+    }
+    status |= W25QXX_STATUS_2_QE;
+    if (w25qxx_write_enable(w25qxx) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    if (w25qxx_command(w25qxx, W25QXX_WRITE_REGISTER_2, 0, 0, 0, 1, &status, 1, 0) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    return w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY);
+}
+#endif
+
+/**
+ * @brief  Select the command used by w25qxx_read
+ *
+ * Dual and quad output are only available when built with W25QXX_QSPI.
+ *
+ * @param  W25Qxx handle
+ * @param  Read mode
+ * @retval W25QXX_Ok if the mode is supported and selected
+ */
+W25QXX_result_t w25qxx_set_read_mode(W25QXX_HandleTypeDef *w25qxx, W25QXX_read_mode_t mode) {
+
+    W25_DBG("w25qxx_set_read_mode: %d", mode);
+
+    switch (mode) {
+    case W25QXX_READ_NORMAL:
+    case W25QXX_READ_FAST:
+        break;
+#ifdef W25QXX_QSPI
+    case W25QXX_READ_DUAL_OUT:
+        if (!w25qxx->dual_read_instruction) {
+            return W25QXX_Err;
+        }
+        break;
+    case W25QXX_READ_QUAD_OUT:
+        if (!w25qxx->quad_read_instruction || w25qxx_quad_enable(w25qxx) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        break;
+#endif
+    default:
+        return W25QXX_Err;
+    }
+
+    w25qxx->read_mode = mode;
+
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Fill in the read and erase commands common to all supported parts
+ *
+ * @param  W25Qxx handle
+ * @retval None
+ */
+static void w25qxx_set_default_commands(W25QXX_HandleTypeDef *w25qxx) {
+    w25qxx->dual_read_instruction = W25QXX_FAST_READ_DUAL_OUT;
+    w25qxx->dual_read_dummy = 8;
+    w25qxx->quad_read_instruction = W25QXX_FAST_READ_QUAD_OUT;
+    w25qxx->quad_read_dummy = 8;
+
+    memset(w25qxx->erase_types, 0, sizeof(w25qxx->erase_types));
+    w25qxx->erase_types[0].instruction = W25QXX_SECTOR_ERASE;
+    w25qxx->erase_types[0].size_shift = 12;
+    w25qxx->erase_types[1].instruction = W25QXX_BLOCK_ERASE_32K;
+    w25qxx->erase_types[1].size_shift = 15;
+    w25qxx->erase_types[2].instruction = W25QXX_BLOCK_ERASE_64K;
+    w25qxx->erase_types[2].size_shift = 16;
+}
+
+/**
+ * @brief  Discover geometry and commands from the JEDEC SFDP Basic Flash Parameter Table
+ *
+ * @param  W25Qxx handle
+ * @retval W25QXX_Ok if a usable table was found and the handle filled in
+ */
+static W25QXX_result_t w25qxx_read_sfdp(W25QXX_HandleTypeDef *w25qxx) {
+
+    uint8_t buf[4 * W25QXX_SFDP_BFPT_DWORDS];
+    uint32_t dw[W25QXX_SFDP_BFPT_DWORDS] = { 0 };
+
+    // SFDP header followed by the first parameter header, which must be the BFPT
+    if (w25qxx_command(w25qxx, W25QXX_READ_SFDP, 0, 3, 8, 1, buf, 16, 1) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    uint32_t signature = (uint32_t) buf[0] | ((uint32_t) buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+    if (signature != W25QXX_SFDP_SIGNATURE || buf[8] != 0x00 || buf[15] != 0xFF) {
+        W25_DBG("w25qxx_read_sfdp: no basic flash parameter table");
+        return W25QXX_Err;
+    }
+
+    uint32_t dwords = buf[11];
+    uint32_t pointer = (uint32_t) buf[12] | ((uint32_t) buf[13] << 8) | ((uint32_t) buf[14] << 16);
+
+    // JESD216 defines at least 9 words
+    if (dwords < 9) {
+        return W25QXX_Err;
+    }
+    if (dwords > W25QXX_SFDP_BFPT_DWORDS) {
+        dwords = W25QXX_SFDP_BFPT_DWORDS;
+    }
+
+    if (w25qxx_command(w25qxx, W25QXX_READ_SFDP, pointer, 3, 8, 1, buf, 4 * dwords, 1) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    for (uint32_t i = 0; i < dwords; ++i) {
+        dw[i] = (uint32_t) buf[4 * i] | ((uint32_t) buf[4 * i + 1] << 8) | ((uint32_t) buf[4 * i + 2] << 16) | ((uint32_t) buf[4 * i + 3] << 24);
+    }
+
+    // Density is in bits, either N + 1 or 2^N
+    uint64_t capacity;
+    if (dw[1] & 0x80000000) {
+        if ((dw[1] & 0x7FFFFFFF) > 35) {
+            return W25QXX_Err;
+        }
+        capacity = (1ULL << (dw[1] & 0x7FFFFFFF)) / 8;
+    } else {
+        capacity = ((uint64_t) dw[1] + 1) / 8;
+    }
+
+    // Erase types (words 8 and 9), smallest first in the table
+    W25QXX_erase_type_t erase_types[W25QXX_ERASE_TYPES] = { 0 };
+    uint8_t sector_shift = 0;
+    for (uint32_t i = 0; i < W25QXX_ERASE_TYPES; ++i) {
+        uint16_t type = (uint16_t) (dw[7 + i / 2] >> (16 * (i % 2)));
+        if (!(uint8_t) type) {
+            continue;
+        }
+        erase_types[i].size_shift = (uint8_t) type;
+        erase_types[i].instruction = (uint8_t) (type >> 8);
+        if (!sector_shift || erase_types[i].size_shift < sector_shift) {
+            sector_shift = erase_types[i].size_shift;
+        }
+    }
+    if (!sector_shift || capacity < W25QXX_BLOCK_64K_SIZE) {
+        return W25QXX_Err;
+    }
+
+    // Page size (word 11, JESD216A and later)
+    uint32_t page_size = 0x100;
+    if (dwords >= 11 && ((dw[10] >> 4) & 0x0F)) {
+        page_size = 1UL << ((dw[10] >> 4) & 0x0F);
+    }
+
+    w25qxx->dual_read_instruction = 0;
+    w25qxx->quad_read_instruction = 0;
+    if (dw[0] & (1UL << 16)) { // 1-1-2 fast read
+        w25qxx->dual_read_instruction = (uint8_t) (dw[3] >> 8);
+        w25qxx->dual_read_dummy = (uint8_t) ((dw[3] & 0x1F) + ((dw[3] >> 5) & 0x07));
+    }
+    if (dw[0] & (1UL << 22)) { // 1-1-4 fast read
+        w25qxx->quad_read_instruction = (uint8_t) (dw[2] >> 24);
+        w25qxx->quad_read_dummy = (uint8_t) (((dw[2] >> 16) & 0x1F) + ((dw[2] >> 21) & 0x07));
+    }
+    memcpy(w25qxx->erase_types, erase_types, sizeof(erase_types));
+
+    // Address bytes: 00 = 3 only, 01 = 3 or 4, 10 = 4 only
+    w25qxx->address_4byte = ((dw[0] >> 17) & 0x03) == 0x02 || capacity > W25QXX_3BYTE_ADDRESS_SIZE;
+
+    w25qxx->block_size = W25QXX_BLOCK_64K_SIZE;
+    w25qxx->block_count = (uint32_t) (capacity / W25QXX_BLOCK_64K_SIZE);
+    w25qxx->sector_size = 1UL << sector_shift;
+    w25qxx->sectors_in_block = w25qxx->block_size / w25qxx->sector_size;
+    w25qxx->page_size = page_size;
+    w25qxx->pages_in_sector = w25qxx->sector_size / page_size;
+
+    W25_DBG("w25qxx_read_sfdp: %" PRIu32 " bytes, sector 0x%04" PRIx32 ", page 0x%04" PRIx32, (uint32_t) capacity, w25qxx->sector_size, page_size);
+
+    return W25QXX_Ok;
 }
 
 #ifdef W25QXX_QSPI
@@ -142,6 +785,9 @@ W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, SPI_HandleTypeDef *hsp
 
     W25_DBG("w25qxx_init");
 
+    // Busy wait until the application installs a hook after init
+    w25qxx->yield = NULL;
+
     char *version_buffer = malloc(strlen(W25QXX_VERSION) + 1);
     if (version_buffer) {
         sprintf(version_buffer, "%s", W25QXX_VERSION);
@@ -156,6 +802,12 @@ W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, SPI_HandleTypeDef *hsp
     w25qxx->cs_pin = cs_pin;
 
     cs_off(w25qxx);
+#ifdef W25QXX_DMA
+    if (dma_register(w25qxx) != W25QXX_Ok) {
+        memset(w25qxx, 0, sizeof(W25QXX_HandleTypeDef));
+        return W25QXX_Err;
+    }
+#endif
 #endif
 
     uint32_t id = w25qxx_read_id(w25qxx);
@@ -163,54 +815,84 @@ W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, SPI_HandleTypeDef *hsp
         w25qxx->manufacturer_id = (uint8_t) (id >> 16);
         w25qxx->device_id = (uint16_t) (id & 0xFFFF);
 
-        switch (w25qxx->manufacturer_id) {
-        case W25QXX_MANUFACTURER_GIGADEVICE:
+        w25qxx_set_default_commands(w25qxx);
 
-            w25qxx->block_size = 0x10000;
-            w25qxx->sector_size = 0x1000;
-            w25qxx->sectors_in_block = 0x10;
-            w25qxx->page_size = 0x100;
-            w25qxx->pages_in_sector = 0x10;
+        // The device may still be in 4 byte mode from before a MCU reset
+        w25qxx->address_4byte = 0;
+        w25qxx_command(w25qxx, W25QXX_EXIT_4BYTE_MODE, 0, 0, 0, 1, NULL, 0, 0);
 
-            switch (w25qxx->device_id) {
-            case 0x6017:
-                w25qxx->block_count = 0x80;
-                break;
-            default:
-                W25_DBG("Unknown Giga Device device");
-                result = W25QXX_Err;
-            }
+        if (w25qxx_read_sfdp(w25qxx) == W25QXX_Ok) {
+            W25_DBG("Geometry from SFDP");
+        } else {
+            switch (w25qxx->manufacturer_id) {
+            case W25QXX_MANUFACTURER_GIGADEVICE:
 
-            break;
-        case W25QXX_MANUFACTURER_WINBOND:
+                w25qxx->block_size = 0x10000;
+                w25qxx->sector_size = 0x1000;
+                w25qxx->sectors_in_block = 0x10;
+                w25qxx->page_size = 0x100;
+                w25qxx->pages_in_sector = 0x10;
 
-            w25qxx->block_size = 0x10000;
-            w25qxx->sector_size = 0x1000;
-            w25qxx->sectors_in_block = 0x10;
-            w25qxx->page_size = 0x100;
-            w25qxx->pages_in_sector = 0x10;
+                switch (w25qxx->device_id) {
+                case 0x6017:
+                    w25qxx->block_count = 0x80;
+                    break;
+                default:
+                    W25_DBG("Unknown Giga Device device");
+                    result = W25QXX_Err;
+                }
 
-            switch (w25qxx->device_id) {
-            case 0x4018:
-                w25qxx->block_count = 0x100;
                 break;
-            case 0x4016:
-                w25qxx->block_count = 0x40;
+            case W25QXX_MANUFACTURER_WINBOND:
+
+                w25qxx->block_size = 0x10000;
+                w25qxx->sector_size = 0x1000;
+                w25qxx->sectors_in_block = 0x10;
+                w25qxx->page_size = 0x100;
+                w25qxx->pages_in_sector = 0x10;
+
+                switch (w25qxx->device_id) {
+                case 0x4018:
+                    w25qxx->block_count = 0x100;
+                    break;
+                case 0x4016:
+                    w25qxx->block_count = 0x40;
+                    break;
+                case 0x4019:
+                    w25qxx->block_count = 0x200;
+                    break;
+                case 0x4020:
+                    w25qxx->block_count = 0x400;
+                    break;
+                default:
+                    W25_DBG("Unknown Winbond device");
+                    result = W25QXX_Err;
+                }
+
                 break;
             default:
-                W25_DBG("Unknown Winbond device");
+                W25_DBG("Unknown manufacturer");
                 result = W25QXX_Err;
             }
-
-            break;
-        default:
-            W25_DBG("Unknown manufacturer");
-            result = W25QXX_Err;
         }
     } else {
         result = W25QXX_Err;
     }
 
+    if (result == W25QXX_Ok && (w25qxx->address_4byte || w25qxx->block_count * w25qxx->block_size > W25QXX_3BYTE_ADDRESS_SIZE)) {
+        W25_DBG("Entering 4 byte address mode");
+        w25qxx->address_4byte = 1;
+        result = w25qxx_command(w25qxx, W25QXX_ENTER_4BYTE_MODE, 0, 0, 0, 1, NULL, 0, 0);
+    }
+
+    if (result == W25QXX_Ok) {
+        result = w25qxx_set_read_mode(w25qxx, W25QXX_DEFAULT_READ_MODE);
+    }
+
+    // A program/erase may have been running across an MCU reset
+    w25qxx_set_pending(w25qxx, W25QXX_OP_UNKNOWN, 0, 0);
+    w25qxx->resume_tick = HAL_GetTick();
+
     if (result == W25QXX_Err) {
         // Zero the handle so it is clear initialization failed!
         memset(w25qxx, 0, sizeof(W25QXX_HandleTypeDef));
@@ -222,42 +904,63 @@ W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, SPI_HandleTypeDef *hsp
 
 W25QXX_result_t w25qxx_read(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len) {
 
-    W25_DBG("w25qxx_read - address: 0x%08lx, lengh: 0x%04lx", address, len);
+    W25_DBG("w25qxx_read - address: 0x%08" PRIx32 ", lengh: 0x%04" PRIx32, address, len);
 
-    // Transmit buffer holding command and address
-    uint8_t tx[4] = {
-    W25QXX_READ_DATA,
-            (uint8_t) (address >> 16),
-            (uint8_t) (address >> 8),
-            (uint8_t) (address)
-    };
+    uint8_t instruction;
+    uint8_t dummy_cycles;
+    uint8_t data_lines;
 
-    // First wait for device to get ready
-    if (w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY) != W25QXX_Ok) {
-        return W25QXX_Err;
+    switch (w25qxx->read_mode) {
+    case W25QXX_READ_FAST:
+        instruction = W25QXX_FAST_READ;
+        dummy_cycles = 8;
+        data_lines = 1;
+        break;
+    case W25QXX_READ_DUAL_OUT:
+        instruction = w25qxx->dual_read_instruction;
+        dummy_cycles = w25qxx->dual_read_dummy;
+        data_lines = 2;
+        break;
+    case W25QXX_READ_QUAD_OUT:
+        instruction = w25qxx->quad_read_instruction;
+        dummy_cycles = w25qxx->quad_read_dummy;
+        data_lines = 4;
+        break;
+    default:
+        instruction = W25QXX_READ_DATA;
+        dummy_cycles = 0;
+        data_lines = 1;
     }
 
-    cs_on(w25qxx);
-    if (w25qxx_transmit(w25qxx, tx, 4) == W25QXX_Ok) { // size will always be fixed
-        if (w25qxx_receive(w25qxx, buf, len) != W25QXX_Ok) {
-            cs_off(w25qxx);
-            return W25QXX_Err;
+    // Suspend a running program/erase elsewhere on the chip, otherwise wait for it
+    uint32_t suspend_tick = HAL_GetTick();
+    if (w25qxx_suspend(w25qxx, address, len)) {
+        W25_STAT(w25qxx, reads);
+        W25QXX_result_t ret = w25qxx_command(w25qxx, instruction, address, address_len(w25qxx), dummy_cycles, data_lines, buf, len, 1);
+        if (w25qxx_resume(w25qxx, suspend_tick) != W25QXX_Ok) {
+            ret = W25QXX_Err;
         }
+        return ret;
     }
-    cs_off(w25qxx);
 
-    return W25QXX_Ok;
+    // First wait for device to get ready
+    if (w25qxx_wait_for_idle(w25qxx) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    W25_STAT(w25qxx, reads);
+    return w25qxx_command(w25qxx, instruction, address, address_len(w25qxx), dummy_cycles, data_lines, buf, len, 1);
 }
 
 W25QXX_result_t w25qxx_write(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len) {
 
-    W25_DBG("w25qxx_write - address 0x%08lx len 0x%04lx", address, len);
+    W25_DBG("w25qxx_write - address 0x%08" PRIx32 " len 0x%04" PRIx32, address, len);
 
     // Let's determine the pages
     uint32_t first_page = address / w25qxx->page_size;
     uint32_t last_page = (address + len - 1) / w25qxx->page_size;
 
-    W25_DBG("w25qxx_write %lu pages from %lu to %lu", 1 + last_page - first_page, first_page, last_page);
+    W25_DBG("w25qxx_write %" PRIu32 " pages from %" PRIu32 " to %" PRIu32, 1 + last_page - first_page, first_page, last_page);
 
     uint32_t buffer_offset = 0;
     uint32_t start_address = address;
@@ -267,27 +970,40 @@ W25QXX_result_t w25qxx_write(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uin
         uint32_t write_len = w25qxx->page_size - (start_address & (w25qxx->page_size - 1));
         write_len = len > write_len ? write_len : len;
 
-        W25_DBG("w25qxx_write: handling page %lu start_address = 0x%08lx buffer_offset = 0x%08lx len = %04lx", page, start_address, buffer_offset, write_len);
+        W25_DBG("w25qxx_write: handling page %" PRIu32 " start_address = 0x%08" PRIx32 " buffer_offset = 0x%08" PRIx32 " len = %04" PRIx32, page, start_address, buffer_offset, write_len);
+        W25_STAT_ADD(w25qxx, program_bytes_requested, write_len);
 
-        // First wait for device to get ready
-        if (w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY) != W25QXX_Ok) {
-            return W25QXX_Err;
+        // Programming 0xFF leaves a NOR cell untouched, so only the span
+        // between the first and last non-0xFF byte has to be sent
+        uint32_t program_start = 0;
+        uint32_t program_len = write_len;
+        while (program_len && buf[buffer_offset + program_start] == 0xFF) {
+            ++program_start;
+            --program_len;
+        }
+        while (program_len && buf[buffer_offset + program_start + program_len - 1] == 0xFF) {
+            --program_len;
         }
 
-        if (w25qxx_write_enable(w25qxx) == W25QXX_Ok) {
+        if (!program_len) {
+            W25_STAT(w25qxx, pages_skipped);
+        } else {
 
-            uint8_t tx[4] = {
-            W25QXX_PAGE_PROGRAM, (uint8_t) (start_address >> 16), (uint8_t) (start_address >> 8), (uint8_t) (start_address), };
+            // First wait for device to get ready
+            if (w25qxx_wait_for_idle(w25qxx) != W25QXX_Ok) {
+                return W25QXX_Err;
+            }
+
+            if (w25qxx_write_enable(w25qxx) == W25QXX_Ok) {
 
-            cs_on(w25qxx);
-            if (w25qxx_transmit(w25qxx, tx, 4) == W25QXX_Ok) { // size will always be fixed
-                // Now write the buffer
-                if (w25qxx_transmit(w25qxx, buf + buffer_offset, write_len) != W25QXX_Ok) {
-                    cs_off(w25qxx);
+                if (w25qxx_command(w25qxx, W25QXX_PAGE_PROGRAM, start_address + program_start, address_len(w25qxx), 0, 1, buf + buffer_offset + program_start, program_len, 0) != W25QXX_Ok) {
                     return W25QXX_Err;
                 }
+
+                W25_STAT(w25qxx, programs);
+                W25_STAT_ADD(w25qxx, program_bytes, program_len);
+                w25qxx_set_pending(w25qxx, W25QXX_OP_PROGRAM, start_address + program_start, program_len);
             }
-            cs_off(w25qxx);
         }
         start_address += write_len;
         buffer_offset += write_len;
@@ -299,7 +1015,7 @@ W25QXX_result_t w25qxx_write(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uin
 
 W25QXX_result_t w25qxx_erase(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint32_t len) {
 
-    W25_DBG("w25qxx_erase, address = 0x%08lx len = 0x%04lx", address, len);
+    W25_DBG("w25qxx_erase, address = 0x%08" PRIx32 " len = 0x%04" PRIx32, address, len);
 
     W25QXX_result_t ret = W25QXX_Ok;
 
@@ -307,46 +1023,62 @@ W25QXX_result_t w25qxx_erase(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uin
     uint32_t first_sector = address / w25qxx->sector_size;
     uint32_t last_sector = (address + len - 1) / w25qxx->sector_size;
 
-    W25_DBG("w25qxx_erase: first sector: 0x%04lx", first_sector);W25_DBG("w25qxx_erase: last sector : 0x%04lx", last_sector);
+    W25_DBG("w25qxx_erase: first sector: 0x%04" PRIx32, first_sector);W25_DBG("w25qxx_erase: last sector : 0x%04" PRIx32, last_sector);
 
-    for (uint32_t sector = first_sector; sector <= last_sector; ++sector) {
+    uint32_t erase_address = first_sector * w25qxx->sector_size;
+    uint32_t end_address = (last_sector + 1) * w25qxx->sector_size;
 
-        W25_DBG("Erasing sector %lu, starting at: 0x%08lx", sector, sector * w25qxx->sector_size);
+    // Use the largest aligned erase unit (e.g. 64 KB, 32 KB or sector) that fits
+    while (erase_address < end_address) {
 
-        // First we have to ensure the device is not busy
-        if (w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY) == W25QXX_Ok) {
-            if (w25qxx_write_enable(w25qxx) == W25QXX_Ok) {
+        uint8_t instruction = W25QXX_SECTOR_ERASE;
+        uint32_t erase_len = w25qxx->sector_size;
 
-                uint32_t sector_start_address = sector * w25qxx->sector_size;
+        for (uint32_t i = 0; i < W25QXX_ERASE_TYPES; ++i) {
+            if (!w25qxx->erase_types[i].size_shift) {
+                continue;
+            }
+            uint32_t type_len = 1UL << w25qxx->erase_types[i].size_shift;
+            if (type_len >= erase_len && !(erase_address & (type_len - 1)) && end_address - erase_address >= type_len) {
+                instruction = w25qxx->erase_types[i].instruction;
+                erase_len = type_len;
+            }
+        }
 
-                uint8_t tx[4] = {
-                W25QXX_SECTOR_ERASE, (uint8_t) (sector_start_address >> 16), (uint8_t) (sector_start_address >> 8), (uint8_t) (sector_start_address), };
+        W25_DBG("Erasing 0x%04" PRIx32 " bytes, starting at: 0x%08" PRIx32, erase_len, erase_address);
 
-                cs_on(w25qxx);
-                if (w25qxx_transmit(w25qxx, tx, 4) != W25QXX_Ok) {
+        // First we have to ensure the device is not busy
+        if (w25qxx_wait_for_idle(w25qxx) == W25QXX_Ok) {
+            if (w25qxx_write_enable(w25qxx) == W25QXX_Ok) {
+
+                if (w25qxx_command(w25qxx, instruction, erase_address, address_len(w25qxx), 0, 1, NULL, 0, 0) != W25QXX_Ok) {
                     ret = W25QXX_Err;
+                } else {
+                    W25_STAT(w25qxx, erases);
+                    w25qxx_set_pending(w25qxx, W25QXX_OP_ERASE, erase_address, erase_len);
                 }
-                cs_off(w25qxx);
             }
         } else {
             ret = W25QXX_Timeout;
         }
 
+        erase_address += erase_len;
     }
 
     return ret;
 }
 
 W25QXX_result_t w25qxx_chip_erase(W25QXX_HandleTypeDef *w25qxx) {
+    if (w25qxx_wait_for_idle(w25qxx) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
     if (w25qxx_write_enable(w25qxx) == W25QXX_Ok) {
-        uint8_t tx[1] = {
-        W25QXX_CHIP_ERASE };
-        cs_on(w25qxx);
-        if (w25qxx_transmit(w25qxx, tx, 1) != W25QXX_Ok) {
+        if (w25qxx_command(w25qxx, W25QXX_CHIP_ERASE, 0, 0, 0, 1, NULL, 0, 0) != W25QXX_Ok) {
             return W25QXX_Err;
         }
-        cs_off(w25qxx);
-        if (w25qxx_wait_for_ready(w25qxx, HAL_MAX_DELAY) != W25QXX_Ok) {
+        W25_STAT(w25qxx, erases);
+        w25qxx_set_pending(w25qxx, W25QXX_OP_CHIP_ERASE, 0, w25qxx->block_count * w25qxx->block_size);
+        if (w25qxx_wait_for_idle(w25qxx) != W25QXX_Ok) {
             return W25QXX_Err;
         }
     }
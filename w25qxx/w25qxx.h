@@ -19,6 +19,7 @@
 #define W25QXX_H_
 
 #ifdef DEBUGxxx
+#include <inttypes.h>
 #define W25_DBG(...) printf(__VA_ARGS__);\
                      printf("\n")
 #else
@@ -36,10 +37,168 @@
 #define W25QXX_WRITE_ENABLE       0x06
 #define W25QXX_PAGE_PROGRAM       0x02
 #define W25QXX_SECTOR_ERASE	      0x20
+#define W25QXX_BLOCK_ERASE_32K    0x52
+#define W25QXX_BLOCK_ERASE_64K    0xD8
 #define W25QXX_CHIP_ERASE         0xc7
 #define W25QXX_READ_REGISTER_1    0x05
+#define W25QXX_READ_REGISTER_2    0x35
+#define W25QXX_WRITE_REGISTER_2   0x31
+#define W25QXX_SUSPEND            0x75
+#define W25QXX_RESUME             0x7A
+#define W25QXX_READ_SFDP          0x5A
+#define W25QXX_ENTER_4BYTE_MODE   0xB7
+#define W25QXX_EXIT_4BYTE_MODE    0xE9
+#define W25QXX_FAST_READ          0x0B
+#define W25QXX_FAST_READ_DUAL_OUT 0x3B
+#define W25QXX_FAST_READ_QUAD_OUT 0x6B
 
+#define W25QXX_SFDP_SIGNATURE     0x50444653 // "SFDP"
+#define W25QXX_SFDP_BFPT_DWORDS   16         // Basic Flash Parameter Table words used
+#define W25QXX_ERASE_TYPES        4
+#define W25QXX_3BYTE_ADDRESS_SIZE 0x1000000  // Larger parts need 4 byte addresses
+
+#define W25QXX_BLOCK_64K_SIZE     0x10000
+
+#define W25QXX_STATUS_1_BUSY      0x01
+#define W25QXX_STATUS_2_QE        0x02
+
+/*
+ * Typical and maximum program/erase times in ticks (ms), W25Q128JV datasheet.
+ * Waits yield until the typical time has passed and then poll the status
+ * register with a back-off of up to W25QXX_POLL_INTERVAL_MAX ticks.  Erases
+ * larger than 64 KB (chip erase) scale the 64 KB figures.
+ */
+#ifndef W25QXX_PAGE_PROGRAM_TIME
+#define W25QXX_PAGE_PROGRAM_TIME      0    // 0.4 ms
+#define W25QXX_PAGE_PROGRAM_TIME_MAX  3
+#define W25QXX_SECTOR_ERASE_TIME      45
+#define W25QXX_SECTOR_ERASE_TIME_MAX  400
+#define W25QXX_BLOCK32_ERASE_TIME     120
+#define W25QXX_BLOCK32_ERASE_TIME_MAX 1600
+#define W25QXX_BLOCK64_ERASE_TIME     150
+#define W25QXX_BLOCK64_ERASE_TIME_MAX 2000
+#endif
+
+#ifndef W25QXX_POLL_INTERVAL_MAX
+#define W25QXX_POLL_INTERVAL_MAX  8
+#endif
+
+/*
+ * Minimum time (in ticks) between a resume and the next suspend so an erase
+ * interrupted by a stream of reads still makes progress.
+ */
+#ifndef W25QXX_SUSPEND_INTERVAL
+#define W25QXX_SUSPEND_INTERVAL   2
+#endif
+
+/*
+ * Define W25QXX_DMA to move data phases of W25QXX_DMA_THRESHOLD bytes or more
+ * with HAL_SPI_*_DMA.  The SPI handle must have its DMA channels linked and the
+ * application's HAL_SPI_TxCpltCallback, HAL_SPI_RxCpltCallback and
+ * HAL_SPI_TxRxCpltCallback must call w25qxx_spi_dma_complete(), its
+ * HAL_SPI_ErrorCallback w25qxx_spi_dma_error().  The wait for a transfer
+ * yields and times out after W25QXX_DMA_TIMEOUT ticks.  Command headers are
+ * always sent polled.  The transfer state lives in each handle, the callbacks
+ * find it among the W25QXX_DMA_HANDLES handles w25qxx_init registered.
+ */
+#ifndef W25QXX_DMA_THRESHOLD
+#define W25QXX_DMA_THRESHOLD      32
+#endif
+
+#ifndef W25QXX_DMA_TIMEOUT
+#define W25QXX_DMA_TIMEOUT        1000
+#endif
+
+#ifndef W25QXX_DMA_HANDLES
+#define W25QXX_DMA_HANDLES        4
+#endif
+
+/*
+ * w25qxx_xfer packs transactions of up to this many bytes into a single
+ * HAL_SPI_TransmitReceive call.
+ */
+#ifndef W25QXX_XFER_PACK_SIZE
+#define W25QXX_XFER_PACK_SIZE     32
+#endif
+
+/*
+ * Read mode used by w25qxx_read.  Normal read is limited to ~50 MHz bus clock,
+ * the fast read variants add 8 dummy clocks and run at full speed.  Dual and
+ * quad output need the multi-line QSPI interface.
+ */
+#ifndef W25QXX_DEFAULT_READ_MODE
+#define W25QXX_DEFAULT_READ_MODE  W25QXX_READ_FAST
+#endif
+
+typedef enum {
+    W25QXX_READ_NORMAL,   // 0x03
+    W25QXX_READ_FAST,     // 0x0B
+    W25QXX_READ_DUAL_OUT, // 0x3B - QSPI only
+    W25QXX_READ_QUAD_OUT  // 0x6B - QSPI only
+} W25QXX_read_mode_t;
+
+/*
+ * Program/erase operation left running in the device when a write or erase
+ * call returns.
+ */
+typedef enum {
+    W25QXX_OP_NONE,       // Device known to be idle
+    W25QXX_OP_UNKNOWN,    // Not known (e.g. after init) - poll before next command
+    W25QXX_OP_PROGRAM,
+    W25QXX_OP_ERASE,
+    W25QXX_OP_CHIP_ERASE
+} W25QXX_op_t;
+
+/*
+ * Erase command covering 2^size_shift bytes (size_shift 0 = unused entry)
+ */
+typedef struct {
+    uint8_t instruction;
+    uint8_t size_shift;
+} W25QXX_erase_type_t;
+
+/*
+ * One part of a w25qxx_xfer transaction.  tx NULL clocks out dummy bytes,
+ * rx NULL discards what is received.
+ */
+typedef struct {
+    const uint8_t *tx;
+    uint8_t *rx;
+    uint32_t len;
+} W25QXX_segment_t;
+
+/*
+ * SPI transactions per kind of command, collected when W25QXX_STATS is defined
+ */
 typedef struct {
+    uint32_t transactions; // All commands
+    uint32_t status_polls;
+    uint32_t reads;
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t polls_skipped; // Status round-trips avoided because the device was known idle
+    uint32_t program_bytes_requested; // Bytes passed to w25qxx_write
+    uint32_t program_bytes;           // Bytes actually clocked out by page program
+    uint32_t pages_skipped;           // Pages that were all 0xFF and never programmed
+} W25QXX_stats_t;
+
+#ifdef W25QXX_STATS
+#define W25_STAT(w25qxx, counter) (++(w25qxx)->stats.counter)
+#define W25_STAT_ADD(w25qxx, counter, n) ((w25qxx)->stats.counter += (n))
+#else
+#define W25_STAT(w25qxx, counter)
+#define W25_STAT_ADD(w25qxx, counter, n)
+#endif
+
+typedef struct W25QXX_Handle W25QXX_HandleTypeDef;
+
+/*
+ * Called repeatedly while waiting for a program/erase to complete, e.g. to
+ * run other work or to sleep/yield to an RTOS.
+ */
+typedef void (*W25QXX_yield_t)(W25QXX_HandleTypeDef *w25qxx);
+
+struct W25QXX_Handle {
 #ifdef W25QXX_QSPI
     QSPI_HandleTypeDef *qspiHandle;
 #else
@@ -55,7 +214,27 @@ typedef struct {
     uint32_t sectors_in_block;
     uint32_t page_size;
     uint32_t pages_in_sector;
-} W25QXX_HandleTypeDef;
+    uint8_t address_4byte;         // Device is in 4 byte address mode
+    W25QXX_read_mode_t read_mode;
+    uint8_t dual_read_instruction; // 0 if not supported
+    uint8_t dual_read_dummy;
+    uint8_t quad_read_instruction; // 0 if not supported
+    uint8_t quad_read_dummy;
+    W25QXX_erase_type_t erase_types[W25QXX_ERASE_TYPES];
+    W25QXX_op_t pending_op;
+    uint32_t pending_address;
+    uint32_t pending_len;
+    uint32_t pending_tick;         // HAL tick when pending_op was issued
+    uint32_t resume_tick;
+    W25QXX_yield_t yield;          // Optional, NULL to busy wait, set after w25qxx_init
+#if defined(W25QXX_DMA) && !defined(W25QXX_QSPI)
+    volatile uint8_t dma_busy;     // Transfer started, callback not seen yet
+    volatile uint8_t dma_result;   // W25QXX_result_t reported by the callback
+#endif
+#ifdef W25QXX_STATS
+    W25QXX_stats_t stats;
+#endif
+};
 
 typedef enum {
     W25QXX_Ok,     // 0
@@ -68,6 +247,14 @@ W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, QSPI_HandleTypeDef *qh
 #else
 W25QXX_result_t w25qxx_init(W25QXX_HandleTypeDef *w25qxx, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin);
 #endif
+#ifndef W25QXX_QSPI
+W25QXX_result_t w25qxx_xfer(W25QXX_HandleTypeDef *w25qxx, const W25QXX_segment_t *segments, uint32_t count);
+#ifdef W25QXX_DMA
+void w25qxx_spi_dma_complete(SPI_HandleTypeDef *hspi);
+void w25qxx_spi_dma_error(SPI_HandleTypeDef *hspi);
+#endif
+#endif
+W25QXX_result_t w25qxx_set_read_mode(W25QXX_HandleTypeDef *w25qxx, W25QXX_read_mode_t mode);
 W25QXX_result_t w25qxx_read(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len);
 W25QXX_result_t w25qxx_write(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len);
 W25QXX_result_t w25qxx_erase(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint32_t len);
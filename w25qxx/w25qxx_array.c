@@ -0,0 +1,172 @@
+/**
+ ******************************************************************************
+ * @file           : w25qxx_array.c
+ * @brief          : Several W25Qxx chips presented as one device
+ ******************************************************************************
+ */
+
+#include "main.h"
+#include "w25qxx.h"
+#include "w25qxx_array.h"
+#include <string.h>
+
+typedef W25QXX_result_t (*w25qxx_array_op_t)(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len);
+
+static inline uint32_t chip_size(W25QXX_HandleTypeDef *w25qxx) {
+    return w25qxx->block_count * w25qxx->block_size;
+}
+
+/**
+ * @brief  Map an array address to a chip and chip address
+ *
+ * @param  Array handle
+ * @param  Array address
+ * @param  Returns the chip index
+ * @param  Returns the address within the chip
+ * @retval Number of bytes from address that stay contiguous on that chip
+ */
+static uint32_t w25qxx_array_map(W25QXX_ArrayTypeDef *array, uint32_t address, uint32_t *chip, uint32_t *chip_address) {
+
+    if (array->mode == W25QXX_ARRAY_STRIPE) {
+        uint32_t stripe = address / array->stripe_size;
+        uint32_t offset = address % array->stripe_size;
+        *chip = stripe % array->chip_count;
+        *chip_address = (stripe / array->chip_count) * array->stripe_size + offset;
+        return array->stripe_size - offset;
+    }
+
+    uint32_t base = 0;
+    for (uint32_t i = 0; i < array->chip_count; ++i) {
+        uint32_t size = chip_size(array->chips[i]);
+        if (address < base + size) {
+            *chip = i;
+            *chip_address = address - base;
+            return base + size - address;
+        }
+        base += size;
+    }
+
+    // Out of range, caught by the callers
+    *chip = array->chip_count;
+    *chip_address = 0;
+    return 0;
+}
+
+/**
+ * @brief  Split a range along chip boundaries and run an operation on each part
+ *
+ * @param  Array handle
+ * @param  Array address
+ * @param  Buffer (may be NULL for erase)
+ * @param  Length
+ * @param  Operation to run on each part
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_array_run(W25QXX_ArrayTypeDef *array, uint32_t address, uint8_t *buf, uint32_t len, w25qxx_array_op_t op) {
+
+    if (address + len > array->size || address + len < address) {
+        W25_DBG("w25qxx_array: 0x%08" PRIx32 " + 0x%04" PRIx32 " out of range", address, len);
+        return W25QXX_Err;
+    }
+
+    while (len) {
+        uint32_t chip;
+        uint32_t chip_address;
+        uint32_t part = w25qxx_array_map(array, address, &chip, &chip_address);
+
+        if (chip >= array->chip_count || !part) {
+            return W25QXX_Err;
+        }
+        if (part > len) {
+            part = len;
+        }
+
+        W25QXX_result_t ret = op(array->chips[chip], chip_address, buf, part);
+        if (ret != W25QXX_Ok) {
+            return ret;
+        }
+
+        address += part;
+        len -= part;
+        if (buf) {
+            buf += part;
+        }
+    }
+
+    return W25QXX_Ok;
+}
+
+static W25QXX_result_t w25qxx_array_erase_part(W25QXX_HandleTypeDef *w25qxx, uint32_t address, uint8_t *buf, uint32_t len) {
+    (void) buf;
+    return w25qxx_erase(w25qxx, address, len);
+}
+
+/**
+ * @brief  Set up an array of already initialized chips
+ *
+ * @param  Array handle
+ * @param  Array of chip handles
+ * @param  Number of chips
+ * @param  Concatenation or striping
+ * @param  Stripe size in bytes, a multiple of the sector size (ignored for concatenation)
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_array_init(W25QXX_ArrayTypeDef *array, W25QXX_HandleTypeDef **chips, uint32_t chip_count, W25QXX_array_mode_t mode, uint32_t stripe_size) {
+
+    W25_DBG("w25qxx_array_init: %" PRIu32 " chips, mode %d", chip_count, mode);
+
+    memset(array, 0, sizeof(W25QXX_ArrayTypeDef));
+
+    if (chip_count == 0 || chip_count > W25QXX_ARRAY_MAX_CHIPS) {
+        return W25QXX_Err;
+    }
+
+    for (uint32_t i = 0; i < chip_count; ++i) {
+        if (!chips[i] || !chips[i]->sector_size) {
+            return W25QXX_Err;
+        }
+        // littlefs and erase splitting need one sector size across the array
+        if (chips[i]->sector_size != chips[0]->sector_size) {
+            return W25QXX_Err;
+        }
+        if (mode == W25QXX_ARRAY_STRIPE && chip_size(chips[i]) != chip_size(chips[0])) {
+            return W25QXX_Err;
+        }
+        array->chips[i] = chips[i];
+        array->size += chip_size(chips[i]);
+    }
+
+    if (mode == W25QXX_ARRAY_STRIPE && (!stripe_size || stripe_size % chips[0]->sector_size || chip_size(chips[0]) % stripe_size)) {
+        return W25QXX_Err;
+    }
+
+    array->chip_count = chip_count;
+    array->mode = mode;
+    array->stripe_size = stripe_size;
+    array->sector_size = chips[0]->sector_size;
+
+    return W25QXX_Ok;
+}
+
+W25QXX_result_t w25qxx_array_read(W25QXX_ArrayTypeDef *array, uint32_t address, uint8_t *buf, uint32_t len) {
+    W25_DBG("w25qxx_array_read - address: 0x%08" PRIx32 ", length: 0x%04" PRIx32, address, len);
+    return w25qxx_array_run(array, address, buf, len, w25qxx_read);
+}
+
+W25QXX_result_t w25qxx_array_write(W25QXX_ArrayTypeDef *array, uint32_t address, uint8_t *buf, uint32_t len) {
+    W25_DBG("w25qxx_array_write - address: 0x%08" PRIx32 ", length: 0x%04" PRIx32, address, len);
+    return w25qxx_array_run(array, address, buf, len, w25qxx_write);
+}
+
+/*
+ * Erases are only issued here, each chip finishes its erase in the background
+ * while the next part is issued to another chip.
+ */
+W25QXX_result_t w25qxx_array_erase(W25QXX_ArrayTypeDef *array, uint32_t address, uint32_t len) {
+    W25_DBG("w25qxx_array_erase - address: 0x%08" PRIx32 ", length: 0x%04" PRIx32, address, len);
+    return w25qxx_array_run(array, address, NULL, len, w25qxx_array_erase_part);
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
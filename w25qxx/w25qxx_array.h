@@ -0,0 +1,46 @@
+/**
+ ******************************************************************************
+ * @file           : w25qxx_array.h
+ * @brief          : Several W25Qxx chips presented as one device
+ ******************************************************************************
+ */
+
+#ifndef W25QXX_ARRAY_H_
+#define W25QXX_ARRAY_H_
+
+#include "w25qxx.h"
+
+#ifndef W25QXX_ARRAY_MAX_CHIPS
+#define W25QXX_ARRAY_MAX_CHIPS 4
+#endif
+
+typedef enum {
+    W25QXX_ARRAY_CONCAT, // Chips follow each other in the address space
+    W25QXX_ARRAY_STRIPE  // Address space is dealt out stripe_size bytes at a time
+} W25QXX_array_mode_t;
+
+/*
+ * Chips are initialized (w25qxx_init) by the caller and may sit on separate CS
+ * pins and/or SPI buses.  Striping needs all chips to share sector size and
+ * capacity.  Since program/erase is left running in each chip, an erase on one
+ * chip overlaps with reads and programs on the others.
+ */
+typedef struct {
+    W25QXX_HandleTypeDef *chips[W25QXX_ARRAY_MAX_CHIPS];
+    uint32_t chip_count;
+    W25QXX_array_mode_t mode;
+    uint32_t stripe_size;
+    uint32_t sector_size;
+    uint32_t size;
+} W25QXX_ArrayTypeDef;
+
+W25QXX_result_t w25qxx_array_init(W25QXX_ArrayTypeDef *array, W25QXX_HandleTypeDef **chips, uint32_t chip_count, W25QXX_array_mode_t mode, uint32_t stripe_size);
+W25QXX_result_t w25qxx_array_read(W25QXX_ArrayTypeDef *array, uint32_t address, uint8_t *buf, uint32_t len);
+W25QXX_result_t w25qxx_array_write(W25QXX_ArrayTypeDef *array, uint32_t address, uint8_t *buf, uint32_t len);
+W25QXX_result_t w25qxx_array_erase(W25QXX_ArrayTypeDef *array, uint32_t address, uint32_t len);
+
+#endif /* W25QXX_ARRAY_H_ */
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,470 @@
+/**
+ ******************************************************************************
+ * @file           : w25qxx_partition.c
+ * @brief          : On-flash partition table and raw partition access
+ ******************************************************************************
+ */
+
+#include "main.h"
+#include "w25qxx.h"
+#include "w25qxx_partition.h"
+#include <stddef.h>
+#include <string.h>
+
+#define W25QXX_LOG_SECTOR_HEADER 8 // Sequence number, format version
+#define W25QXX_LOG_RECORD_HEADER 6 // Record length, CRC of length and payload
+#define W25QXX_LOG_EMPTY         0xFFFFFFFF
+#define W25QXX_LOG_VERSION       2
+
+static inline uint32_t chip_size(W25QXX_HandleTypeDef *w25qxx) {
+    return w25qxx->block_count * w25qxx->block_size;
+}
+
+static uint32_t w25qxx_crc_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+static uint32_t w25qxx_partition_crc(const uint8_t *data, uint32_t len) {
+    return ~w25qxx_crc_update(0xFFFFFFFF, data, len);
+}
+
+/**
+ * @brief  Check that entries are sector aligned, fit on the chip after the
+ *         table sector and do not overlap
+ *
+ * @param  Chip handle
+ * @param  Entries
+ * @param  Number of entries
+ * @retval W25QXX_Ok if the layout is usable
+ */
+static W25QXX_result_t w25qxx_partition_check(W25QXX_HandleTypeDef *w25qxx, const W25QXX_partition_entry_t *entries, uint32_t count) {
+
+    if (count > W25QXX_PARTITION_MAX) {
+        return W25QXX_Err;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const W25QXX_partition_entry_t *e = &entries[i];
+        if (!e->size || e->offset % w25qxx->sector_size || e->size % w25qxx->sector_size) {
+            return W25QXX_Err;
+        }
+        if (e->offset < w25qxx->sector_size || e->offset > chip_size(w25qxx) || e->size > chip_size(w25qxx) - e->offset) {
+            return W25QXX_Err;
+        }
+        for (uint32_t j = 0; j < i; ++j) {
+            if (e->offset < entries[j].offset + entries[j].size && entries[j].offset < e->offset + e->size) {
+                return W25QXX_Err;
+            }
+        }
+    }
+
+    return W25QXX_Ok;
+}
+
+static inline W25QXX_result_t w25qxx_partition_bounds(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint32_t len) {
+    if (offset > partition->size || len > partition->size - offset) {
+        W25_DBG("w25qxx_partition %s: 0x%08" PRIx32 " + 0x%04" PRIx32 " out of range", partition->name, offset, len);
+        return W25QXX_Err;
+    }
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Read the partition table from the first sector of the chip
+ *
+ * @param  Table handle
+ * @param  Initialized chip handle
+ * @retval W25QXX_Ok if a valid table was found
+ */
+W25QXX_result_t w25qxx_partition_load(W25QXX_PartitionTableTypeDef *table, W25QXX_HandleTypeDef *w25qxx) {
+
+    W25_DBG("w25qxx_partition_load");
+
+    W25QXX_partition_table_t raw;
+
+    memset(table, 0, sizeof(W25QXX_PartitionTableTypeDef));
+
+    if (w25qxx_read(w25qxx, 0, (uint8_t*) &raw, sizeof(raw)) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    if (raw.magic != W25QXX_PARTITION_MAGIC || raw.crc != w25qxx_partition_crc((uint8_t*) &raw, offsetof(W25QXX_partition_table_t, crc))) {
+        W25_DBG("w25qxx_partition_load: no valid table");
+        return W25QXX_Err;
+    }
+
+    if (w25qxx_partition_check(w25qxx, raw.entries, raw.count) != W25QXX_Ok) {
+        W25_DBG("w25qxx_partition_load: table does not fit this chip");
+        return W25QXX_Err;
+    }
+
+    for (uint32_t i = 0; i < raw.count; ++i) {
+        W25QXX_PartitionTypeDef *p = &table->partitions[i];
+        p->w25qxx = w25qxx;
+        memcpy(p->name, raw.entries[i].name, W25QXX_PARTITION_NAME_LEN);
+        p->type = raw.entries[i].type;
+        p->offset = raw.entries[i].offset;
+        p->size = raw.entries[i].size;
+    }
+    table->count = raw.count;
+
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Write a new partition table and load it.  Data in existing
+ *         partitions is left alone.
+ *
+ * @param  Table handle
+ * @param  Initialized chip handle
+ * @param  Entries
+ * @param  Number of entries
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_partition_create(W25QXX_PartitionTableTypeDef *table, W25QXX_HandleTypeDef *w25qxx, const W25QXX_partition_entry_t *entries, uint32_t count) {
+
+    W25_DBG("w25qxx_partition_create: %" PRIu32 " partitions", count);
+
+    W25QXX_partition_table_t raw;
+
+    if (w25qxx_partition_check(w25qxx, entries, count) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    memset(&raw, 0, sizeof(raw));
+    raw.magic = W25QXX_PARTITION_MAGIC;
+    raw.count = count;
+    memcpy(raw.entries, entries, count * sizeof(W25QXX_partition_entry_t));
+    raw.crc = w25qxx_partition_crc((uint8_t*) &raw, offsetof(W25QXX_partition_table_t, crc));
+
+    if (w25qxx_erase(w25qxx, 0, w25qxx->sector_size) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    if (w25qxx_write(w25qxx, 0, (uint8_t*) &raw, sizeof(raw)) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    return w25qxx_partition_load(table, w25qxx);
+}
+
+W25QXX_PartitionTypeDef *w25qxx_partition_find(W25QXX_PartitionTableTypeDef *table, const char *name) {
+    for (uint32_t i = 0; i < table->count; ++i) {
+        if (strncmp(table->partitions[i].name, name, W25QXX_PARTITION_NAME_LEN) == 0) {
+            return &table->partitions[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Offsets below are relative to the start of the partition.  Accesses that
+ * would cross the end of the partition fail without touching the chip.
+ */
+
+W25QXX_result_t w25qxx_partition_read(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint8_t *buf, uint32_t len) {
+    if (w25qxx_partition_bounds(partition, offset, len) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    return w25qxx_read(partition->w25qxx, partition->offset + offset, buf, len);
+}
+
+W25QXX_result_t w25qxx_partition_write(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint8_t *buf, uint32_t len) {
+    if (w25qxx_partition_bounds(partition, offset, len) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    return w25qxx_write(partition->w25qxx, partition->offset + offset, buf, len);
+}
+
+/*
+ * Erases whole sectors, so offset and len should be sector aligned
+ */
+W25QXX_result_t w25qxx_partition_erase(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint32_t len) {
+    if (w25qxx_partition_bounds(partition, offset, len) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    return w25qxx_erase(partition->w25qxx, partition->offset + offset, len);
+}
+
+/**
+ * @brief  Read the sequence number of a log sector
+ *
+ * @param  Log partition
+ * @param  Sector within the partition
+ * @param  Returns the sequence number, W25QXX_LOG_EMPTY if the sector is blank
+ *         or holds another log format
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_log_sequence(W25QXX_PartitionTypeDef *partition, uint32_t sector, uint32_t *sequence) {
+
+    uint32_t header[2];
+
+    if (w25qxx_partition_read(partition, sector * partition->w25qxx->sector_size, (uint8_t*) header, sizeof(header)) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    *sequence = header[1] == W25QXX_LOG_VERSION ? header[0] : W25QXX_LOG_EMPTY;
+    return W25QXX_Ok;
+}
+
+static W25QXX_result_t w25qxx_log_start_sector(W25QXX_LogTypeDef *log, uint32_t sector, uint32_t sequence) {
+
+    uint32_t sector_size = log->partition->w25qxx->sector_size;
+    uint32_t header[2] = { sequence, W25QXX_LOG_VERSION };
+
+    W25_DBG("w25qxx_log: starting sector %" PRIu32 " sequence %" PRIu32, sector, sequence);
+
+    if (w25qxx_partition_erase(log->partition, sector * sector_size, sector_size) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    if (w25qxx_partition_write(log->partition, sector * sector_size, (uint8_t*) header, sizeof(header)) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    log->sector = sector;
+    log->sequence = sequence;
+    log->head = sector * sector_size + W25QXX_LOG_SECTOR_HEADER;
+
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Check a record against the CRC in its header
+ *
+ * @param  Log handle
+ * @param  Record header
+ * @param  Partition offset of the payload
+ * @param  Payload already read, NULL to read it here
+ * @param  Returns non-zero if the CRC matches
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_log_check(W25QXX_LogTypeDef *log, const uint8_t *header, uint32_t pos, const uint8_t *payload, uint8_t *match) {
+
+    uint16_t len;
+    uint32_t crc;
+    memcpy(&len, header, sizeof(len));
+    memcpy(&crc, header + sizeof(len), sizeof(crc));
+
+    uint32_t check = w25qxx_crc_update(0xFFFFFFFF, header, sizeof(len));
+    if (payload) {
+        check = w25qxx_crc_update(check, payload, len);
+    } else {
+        uint8_t chunk[32];
+        for (uint32_t done = 0; done < len; done += sizeof(chunk)) {
+            uint32_t n = len - done > sizeof(chunk) ? sizeof(chunk) : len - done;
+            if (w25qxx_partition_read(log->partition, pos + done, chunk, n) != W25QXX_Ok) {
+                return W25QXX_Err;
+            }
+            check = w25qxx_crc_update(check, chunk, n);
+        }
+    }
+    *match = ~check == crc;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Follow the records of one sector
+ *
+ * Stops at unwritten space or at the first record whose CRC does not match,
+ * e.g. one cut short by power loss.
+ *
+ * @param  Log handle
+ * @param  Sector within the partition
+ * @param  Returns the partition offset just after the last record
+ * @param  Buffer for records, NULL to only find the end
+ * @param  Buffer size
+ * @param  Callback for each record
+ * @param  Callback context
+ * @retval W25QXX_Ok on success
+ */
+static W25QXX_result_t w25qxx_log_scan(W25QXX_LogTypeDef *log, uint32_t sector, uint32_t *end, uint8_t *buf, uint16_t buf_size, W25QXX_log_cb_t cb, void *context) {
+
+    uint32_t sector_size = log->partition->w25qxx->sector_size;
+    uint32_t pos = sector * sector_size + W25QXX_LOG_SECTOR_HEADER;
+    uint32_t limit = (sector + 1) * sector_size;
+
+    if (sector == log->sector && log->head) {
+        limit = log->head;
+    }
+
+    while (pos + W25QXX_LOG_RECORD_HEADER <= limit) {
+        uint8_t header[W25QXX_LOG_RECORD_HEADER];
+        uint16_t len;
+        if (w25qxx_partition_read(log->partition, pos, header, sizeof(header)) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        memcpy(&len, header, sizeof(len));
+        // 0xFFFF is unwritten space, a length running past the sector is damage
+        if (len == 0xFFFF || pos + W25QXX_LOG_RECORD_HEADER + len > limit) {
+            break;
+        }
+        if (buf && len > buf_size) {
+            return W25QXX_Err;
+        }
+        if (buf && w25qxx_partition_read(log->partition, pos + W25QXX_LOG_RECORD_HEADER, buf, len) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        uint8_t match;
+        if (w25qxx_log_check(log, header, pos + W25QXX_LOG_RECORD_HEADER, buf, &match) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        if (!match) {
+            break;
+        }
+        if (buf) {
+            cb(log, buf, len, context);
+        }
+        pos += W25QXX_LOG_RECORD_HEADER + len;
+    }
+
+    *end = pos;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Open the log in a partition, starting it if the partition is empty
+ *
+ * @param  Log handle
+ * @param  Partition of type W25QXX_PARTITION_LOG
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_log_open(W25QXX_LogTypeDef *log, W25QXX_PartitionTypeDef *partition) {
+
+    memset(log, 0, sizeof(W25QXX_LogTypeDef));
+
+    if (!partition || partition->type != W25QXX_PARTITION_LOG) {
+        return W25QXX_Err;
+    }
+
+    log->partition = partition;
+
+    uint32_t sector_size = partition->w25qxx->sector_size;
+    uint32_t sectors = partition->size / sector_size;
+    uint32_t best = sectors;
+    uint32_t best_sequence = 0;
+
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        uint32_t sequence;
+        if (w25qxx_log_sequence(partition, sector, &sequence) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        if (sequence != W25QXX_LOG_EMPTY && (best == sectors || sequence > best_sequence)) {
+            best = sector;
+            best_sequence = sequence;
+        }
+    }
+
+    if (best == sectors) {
+        return w25qxx_log_start_sector(log, 0, 1);
+    }
+
+    log->sector = best;
+    log->sequence = best_sequence;
+
+    uint32_t head;
+    if (w25qxx_log_scan(log, best, &head, NULL, 0, NULL, NULL) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    // A record cut short by power loss leaves programmed bytes past the last
+    // complete record, continue in a fresh sector rather than write over them
+    uint8_t blank[32];
+    for (uint32_t pos = head; pos < (best + 1) * sector_size; pos += sizeof(blank)) {
+        uint32_t len = (best + 1) * sector_size - pos;
+        len = len > sizeof(blank) ? sizeof(blank) : len;
+        if (w25qxx_partition_read(partition, pos, blank, len) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        for (uint32_t i = 0; i < len; ++i) {
+            if (blank[i] != 0xFF) {
+                return w25qxx_log_start_sector(log, (best + 1) % sectors, best_sequence + 1);
+            }
+        }
+    }
+
+    log->head = head;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Append one record, moving on to the next sector when it does not fit
+ *
+ * @param  Log handle
+ * @param  Record
+ * @param  Record length, at most a sector less the sector and record headers
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_log_append(W25QXX_LogTypeDef *log, const uint8_t *record, uint16_t len) {
+
+    uint32_t sector_size = log->partition->w25qxx->sector_size;
+
+    if (len == 0xFFFF || len > sector_size - W25QXX_LOG_SECTOR_HEADER - W25QXX_LOG_RECORD_HEADER) {
+        return W25QXX_Err;
+    }
+
+    if (log->head + W25QXX_LOG_RECORD_HEADER + len > (log->sector + 1) * sector_size) {
+        uint32_t sectors = log->partition->size / sector_size;
+        if (w25qxx_log_start_sector(log, (log->sector + 1) % sectors, log->sequence + 1) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+    }
+
+    // Payload first, the header makes the record visible and its CRC
+    // catches either write being cut short
+    uint8_t header[W25QXX_LOG_RECORD_HEADER];
+    memcpy(header, &len, sizeof(len));
+    uint32_t crc = ~w25qxx_crc_update(w25qxx_crc_update(0xFFFFFFFF, header, sizeof(len)), record, len);
+    memcpy(header + sizeof(len), &crc, sizeof(crc));
+
+    if (len && w25qxx_partition_write(log->partition, log->head + W25QXX_LOG_RECORD_HEADER, (uint8_t*) record, len) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+    if (w25qxx_partition_write(log->partition, log->head, header, sizeof(header)) != W25QXX_Ok) {
+        return W25QXX_Err;
+    }
+
+    log->head += W25QXX_LOG_RECORD_HEADER + len;
+    return W25QXX_Ok;
+}
+
+/**
+ * @brief  Call cb for every record, oldest first
+ *
+ * @param  Log handle
+ * @param  Buffer records are read into
+ * @param  Buffer size, larger records fail the walk
+ * @param  Callback
+ * @param  Callback context
+ * @retval W25QXX_Ok on success
+ */
+W25QXX_result_t w25qxx_log_walk(W25QXX_LogTypeDef *log, uint8_t *buf, uint16_t buf_size, W25QXX_log_cb_t cb, void *context) {
+
+    uint32_t sector_size = log->partition->w25qxx->sector_size;
+    uint32_t sectors = log->partition->size / sector_size;
+
+    for (uint32_t i = 1; i <= sectors; ++i) {
+        uint32_t sector = (log->sector + i) % sectors;
+        uint32_t sequence;
+        uint32_t end;
+
+        if (w25qxx_log_sequence(log->partition, sector, &sequence) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+        if (sequence == W25QXX_LOG_EMPTY || sequence > log->sequence) {
+            continue;
+        }
+        if (w25qxx_log_scan(log, sector, &end, buf, buf_size, cb, context) != W25QXX_Ok) {
+            return W25QXX_Err;
+        }
+    }
+
+    return W25QXX_Ok;
+}
+
+/*
+ * vim: ts=4 et nowrap
+ */
@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * @file           : w25qxx_partition.h
+ * @brief          : On-flash partition table and raw partition access
+ ******************************************************************************
+ */
+
+#ifndef W25QXX_PARTITION_H_
+#define W25QXX_PARTITION_H_
+
+#include "w25qxx.h"
+
+#define W25QXX_PARTITION_MAGIC    0x54503257 // "W2PT"
+#define W25QXX_PARTITION_NAME_LEN 8
+
+#ifndef W25QXX_PARTITION_MAX
+#define W25QXX_PARTITION_MAX 8
+#endif
+
+typedef enum {
+    W25QXX_PARTITION_BLOB = 1,    // Raw slot, e.g. firmware staging
+    W25QXX_PARTITION_LOG = 2,     // Circular record log, see w25qxx_log_*
+    W25QXX_PARTITION_LITTLEFS = 3 // LittleFS volume
+} W25QXX_partition_type_t;
+
+/*
+ * Partition entry as stored in the table.  Offset and size are in bytes and
+ * sector aligned; the first sector of the chip holds the table itself.
+ */
+typedef struct {
+    char name[W25QXX_PARTITION_NAME_LEN]; // Not necessarily 0 terminated
+    uint32_t type;
+    uint32_t offset;
+    uint32_t size;
+} W25QXX_partition_entry_t;
+
+/*
+ * Layout of the table sector
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    W25QXX_partition_entry_t entries[W25QXX_PARTITION_MAX];
+    uint32_t crc;
+} W25QXX_partition_table_t;
+
+typedef struct {
+    W25QXX_HandleTypeDef *w25qxx;
+    char name[W25QXX_PARTITION_NAME_LEN + 1];
+    W25QXX_partition_type_t type;
+    uint32_t offset;
+    uint32_t size;
+} W25QXX_PartitionTypeDef;
+
+typedef struct {
+    uint32_t count;
+    W25QXX_PartitionTypeDef partitions[W25QXX_PARTITION_MAX];
+} W25QXX_PartitionTableTypeDef;
+
+/*
+ * Circular log in a W25QXX_PARTITION_LOG partition.  Every sector starts with
+ * a 32 bit sequence number and a 32 bit format version (2), followed by
+ * records of a 16 bit length, a CRC-32 of the length and payload, and the
+ * payload.  Reading stops at the first record whose CRC does not match.
+ * Sectors of another version are treated as empty.  When the current sector
+ * is full the next one (wrapping around) is erased, dropping the oldest
+ * records.
+ */
+typedef struct {
+    W25QXX_PartitionTypeDef *partition;
+    uint32_t sequence; // Sequence number of the current sector
+    uint32_t sector;   // Current sector within the partition
+    uint32_t head;     // Partition offset of the next record
+} W25QXX_LogTypeDef;
+
+typedef void (*W25QXX_log_cb_t)(W25QXX_LogTypeDef *log, const uint8_t *record, uint16_t len, void *context);
+
+W25QXX_result_t w25qxx_partition_load(W25QXX_PartitionTableTypeDef *table, W25QXX_HandleTypeDef *w25qxx);
+W25QXX_result_t w25qxx_partition_create(W25QXX_PartitionTableTypeDef *table, W25QXX_HandleTypeDef *w25qxx, const W25QXX_partition_entry_t *entries, uint32_t count);
+W25QXX_PartitionTypeDef *w25qxx_partition_find(W25QXX_PartitionTableTypeDef *table, const char *name);
+W25QXX_result_t w25qxx_partition_read(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint8_t *buf, uint32_t len);
+W25QXX_result_t w25qxx_partition_write(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint8_t *buf, uint32_t len);
+W25QXX_result_t w25qxx_partition_erase(W25QXX_PartitionTypeDef *partition, uint32_t offset, uint32_t len);
+
+W25QXX_result_t w25qxx_log_open(W25QXX_LogTypeDef *log, W25QXX_PartitionTypeDef *partition);
+W25QXX_result_t w25qxx_log_append(W25QXX_LogTypeDef *log, const uint8_t *record, uint16_t len);
+W25QXX_result_t w25qxx_log_walk(W25QXX_LogTypeDef *log, uint8_t *buf, uint16_t buf_size, W25QXX_log_cb_t cb, void *context);
+
+#endif /* W25QXX_PARTITION_H_ */
+
+/*
+ * vim: ts=4 et nowrap
+ */